@@ -1,7 +1,9 @@
-from typing import Any, Dict, List, Optional, Tuple, Union
+import gc
+from contextlib import contextmanager, nullcontext
+from typing import Any, Callable, Dict, Iterable, Iterator, List, Optional, Tuple, Union
 
 from hyperon_das_atomdb.database import UNORDERED_LINK_TYPES, WILDCARD, AtomDB
-from hyperon_das_atomdb.entity import Database, Link
+from hyperon_das_atomdb.entity import AtomKind, ColumnarLink, Database, HandleTable, Link, id_array
 from hyperon_das_atomdb.exceptions import (
     AtomDoesNotExist,
     InvalidOperationException,
@@ -9,45 +11,290 @@ from hyperon_das_atomdb.exceptions import (
     NodeDoesNotExist,
 )
 from hyperon_das_atomdb.utils.expression_hasher import ExpressionHasher
-from hyperon_das_atomdb.utils.patterns import build_patern_keys
+from hyperon_das_atomdb.utils.handles import handle_codec
+from hyperon_das_atomdb.utils.locks import ReadWriteLock, read_locked, write_locked
+from hyperon_das_atomdb.utils.memory import DEFAULT_SAMPLE_SIZE, cache_stats, memory_stats
+from hyperon_das_atomdb.utils.patterns import FullPatternIndex, PatternIndexStrategy
+from hyperon_das_atomdb.utils.postings import (
+    add_posting,
+    add_postings,
+    intersect,
+    page,
+    remove_posting,
+    union,
+)
+from hyperon_das_atomdb.utils.snapshot import (
+    Snapshot,
+    decode_strategies,
+    decode_strategy,
+    encode_strategies,
+    encode_strategy,
+    open_database,
+    save_database,
+    thaw_database,
+)
+from hyperon_das_atomdb.utils.trigrams import TrigramIndex
+
+# Default query_cache_size: decoded handles and matches (handle, targets) kept by
+# InMemoryDB for the atoms returned by queries (about 12MB of matches of arity 2).
+# Each cache is emptied when it reaches this many atoms.
+QUERY_CACHE_SIZE = 1 << 16
+# Default result_cache_size: match lists kept for the pattern and template keys
+# queried (without pagination) since the last write
+RESULT_CACHE_SIZE = 64
+
+
+class _QueryCache(dict):
+    """
+    Values built on the first lookup of an atom id, by build(atom_id), and kept
+    up to size atoms. With size 0 nothing is kept.
+    """
+
+    def __init__(self, build: Callable[[int], Any], size: int) -> None:
+        super().__init__()
+        self._build = build
+        self.size = size
+
+    def __missing__(self, atom_id: int) -> Any:
+        if not self.size:
+            return self._build(atom_id)
+        if len(self) >= self.size:
+            self.clear()
+        value = self[atom_id] = self._build(atom_id)
+        return value
 
 
 class InMemoryDB(AtomDB):
-    """A concrete implementation using hashtable (dict)"""
+    """
+    A concrete implementation using hashtable (dict)
+
+    pattern_index_strategy chooses how links are posted to the patterns index
+    (see utils.patterns). link_type_pattern_index overrides it per link type,
+    e.g. {'Set': PositionalPatternIndex()} for high arity links.
+
+    With columnar_links, links are kept in per-arity struct-of-arrays tables
+    (see entity.ColumnarLink) instead of one dict per link.
+
+    With trigram_index, node names are indexed by trigrams (per node type) so
+    get_matched_node_name only verifies the nodes having every trigram of the
+    substring.
+
+    save_snapshot() writes the database to a file which open_snapshot() memory
+    maps and queries in place (see utils.snapshot). The first write to a database
+    opened from a snapshot copies it into regular structures.
+
+    With thread_safe, queries run concurrently and writes one at a time, never
+    along with a query (see utils.locks.ReadWriteLock). Iterators returned by
+    queries are then built before the lock is released.
+
+    Inside bulk_load() (or add_atoms()) atoms are stored as they are added but
+    indexed only at the end of the block, in one pass grouping the postings of
+    each index key.
+
+    Indexes hold atom ids. The handles and (handle, targets) matches returned by
+    queries are built on first use and cached per id, up to query_cache_size
+    atoms, and the match lists of up to result_cache_size keys queried (those
+    no longer than query_cache_size) are kept until the next write. Either cache is disabled with a size of 0; memory_stats()
+    reports both.
+    """
 
     def __repr__(self) -> str:
         return "<Atom database InMemory>"  # pragma no cover
 
-    def __init__(self, database_name: str = 'das') -> None:
+    def __init__(
+        self,
+        database_name: str = 'das',
+        compact_handles: bool = False,
+        hash_scheme: Optional[str] = None,
+        pattern_index_strategy: Optional[PatternIndexStrategy] = None,
+        link_type_pattern_index: Optional[Dict[str, PatternIndexStrategy]] = None,
+        columnar_links: bool = False,
+        trigram_index: bool = False,
+        thread_safe: bool = False,
+        query_cache_size: int = QUERY_CACHE_SIZE,
+        result_cache_size: int = RESULT_CACHE_SIZE,
+    ) -> None:
         self.database_name = database_name
-        self.named_type_table = {}  # keyed by named type hash
+        # Read/write lock taken by the public methods, with thread_safe
+        self._lock: Optional[ReadWriteLock] = ReadWriteLock() if thread_safe else None
+        self.handle_codec = handle_codec(compact_handles)
+        self.hasher = ExpressionHasher.for_scheme(hash_scheme)
+        self.pattern_index_strategy = pattern_index_strategy or FullPatternIndex()
+        self.link_type_pattern_index = dict(link_type_pattern_index or {})
+        # Strategies of the link types (by named type hash) whose patterns aren't all indexed
+        self.partial_pattern_index = {}
+        self.named_type_registry = self.hasher.named_types
         self.all_named_types = set()
-        self.db: Database = Database(
+        self.columnar_links = columnar_links
+        self.trigram_index = trigram_index
+        # Mapped snapshot the database is read from, until the first write
+        self._snapshot: Optional[Snapshot] = None
+        # Atoms added inside bulk_load() and not indexed yet (None outside of it)
+        self._pending_nodes: Optional[Dict[int, Dict[str, Any]]] = None
+        self._pending_links: Optional[Dict[int, Tuple[Dict[str, Any], List[int], bool]]] = None
+        self.db: Database = self._new_database()
+        self._handles = _QueryCache(self._decode_handle, query_cache_size)
+        self._matches = _QueryCache(self._build_match, query_cache_size)
+        self._results: Dict[Tuple[Any, ...], list] = {}
+        self.result_cache_size = result_cache_size
+
+    def _new_database(self) -> Database:
+        handles = HandleTable()
+        if self.columnar_links:
+            link = ColumnarLink(handles)
+            outgoing_set = link.outgoing_set()
+        else:
+            link = Link(arity_1={}, arity_2={}, arity_n={})
+            outgoing_set = {}
+        return Database(
             atom_type={},
             node={},
-            link=Link(arity_1={}, arity_2={}, arity_n={}),
-            outgoing_set={},
+            link=link,
+            outgoing_set=outgoing_set,
             incomming_set={},
             patterns={},
             templates={},
+            metadata=self.hasher.metadata(),
+            handles=handles,
+            node_names=TrigramIndex() if self.trigram_index else None,
         )
 
-    def _get_link(self, handle: str) -> Optional[Dict[str, Any]]:
-        for table in self.db.link.all_tables():
-            link = table.get(handle)
-            if link is not None:
-                return link
-        return None
+    @read_locked
+    def save_snapshot(self, path: str) -> None:
+        """
+        Save the database to a snapshot file, which open_snapshot() maps without
+        parsing nor rebuilding indexes. The file is written aside and renamed.
+
+        Raises:
+            InvalidOperationException: If a custom attribute isn't a JSON value or
+                a pattern index strategy isn't one of utils.patterns.
+        """
+        self._index_pending()
+        save_database(
+            path,
+            self.db,
+            {
+                'compact_handles': self.handle_codec.compact,
+                'columnar_links': self.columnar_links,
+                'all_named_types': sorted(self.all_named_types),
+                'partial_pattern_index': encode_strategies(self.partial_pattern_index),
+                'pattern_index_strategy': encode_strategy(self.pattern_index_strategy),
+                'link_type_pattern_index': encode_strategies(self.link_type_pattern_index),
+            },
+        )
+
+    @classmethod
+    def open_snapshot(
+        cls,
+        path: str,
+        database_name: str = 'das',
+        hash_scheme: Optional[str] = None,
+        trigram_index: bool = False,
+        thread_safe: bool = False,
+        query_cache_size: int = QUERY_CACHE_SIZE,
+        result_cache_size: int = RESULT_CACHE_SIZE,
+    ) -> 'InMemoryDB':
+        """
+        Open a database saved by save_snapshot(). Atoms and indexes are read from
+        the mapped file. The trigram index isn't saved; with trigram_index it's
+        rebuilt on the first write.
+
+        The header of a snapshot is JSON and its sections are flat arrays, so
+        opening a file doesn't run code from it. The sections aren't validated
+        though: only open snapshots from trusted sources, since a crafted or
+        corrupted file can make queries fail or return wrong atoms.
+
+        Raises:
+            InvalidHashScheme: If hash_scheme isn't the scheme of the snapshot.
+            InvalidOperationException: If the file isn't a snapshot of this version.
+        """
+        snapshot = Snapshot(path)
+        header = snapshot.header
+        metadata = header['metadata']
+        db = cls(
+            database_name=database_name,
+            compact_handles=header['compact_handles'],
+            hash_scheme=hash_scheme or metadata.get('hash_scheme'),
+            pattern_index_strategy=decode_strategy(header['pattern_index_strategy']),
+            link_type_pattern_index=decode_strategies(header['link_type_pattern_index']),
+            columnar_links=header['columnar_links'],
+            trigram_index=trigram_index,
+            thread_safe=thread_safe,
+            query_cache_size=query_cache_size,
+            result_cache_size=result_cache_size,
+        )
+        db._check_hash_scheme(metadata)
+        for named_type in header['types']:
+            db.named_type_registry.named_type_hash(named_type)
+        db.all_named_types = set(header['all_named_types'])
+        db.partial_pattern_index = decode_strategies(header['partial_pattern_index'])
+        db.db = open_database(snapshot, db.named_type_registry.named_type_hash)
+        db.db.node_names = None
+        db._snapshot = snapshot
+        return db
+
+    def _thaw(self) -> None:
+        if self._snapshot is None:
+            return
+        self.db = thaw_database(self.db, self.columnar_links)
+        if self.trigram_index:
+            self.db.node_names = TrigramIndex()
+            for node_id, node in self.db.node.items():
+                self.db.node_names.add(node['composite_type_hash'], node_id, node['name'])
+        self._snapshot = None
+
+    def _intern(self, handle: str) -> int:
+        return self.db.handles.intern(self.handle_codec.encode(handle))
+
+    def _get_id(self, handle: str) -> Optional[int]:
+        return self.db.handles.get(self.handle_codec.encode(handle))
+
+    def _decode_handle(self, atom_id: int) -> str:
+        return self.handle_codec.decode(self.db.handles.handles[atom_id])
+
+    def _handle_getter(self) -> Callable[[int], str]:
+        handles = self.db.handles.handles
+        if not self.handle_codec.compact and isinstance(handles, list):
+            # The interned handles are the API handles already
+            return handles.__getitem__
+        return self._handles.__getitem__
+
+    def _handle(self, atom_id: int) -> str:
+        return self._handle_getter()(atom_id)
+
+    def _get_link(self, atom_id: Optional[int]) -> Optional[Dict[str, Any]]:
+        kind = self.db.directory.kind(atom_id)
+        if kind is None or kind == AtomKind.NODE:
+            return None
+        return self.db.link.get_table(kind.bucket_arity).get(atom_id)
+
+    def _get_atom_type(self, handle: str, link: bool) -> Optional[str]:
+        atom_id = self._get_id(handle)
+        kind = self.db.directory.kind(atom_id)
+        if kind is None or (kind != AtomKind.NODE) != link:
+            return None
+        return self.db.directory.named_type(atom_id)
+
+    def _build_document(
+        self, atom_id: int, document: Dict[str, Any], target_ids: List[int]
+    ) -> Dict[str, Any]:
+        # The stored document refers to the interned handles instead of holding copies of them
+        handles = self.db.handles.handles
+        answer = dict(document)
+        answer['_id'] = handles[atom_id]
+        for position, target_id in enumerate(target_ids):
+            answer[f'key_{position}'] = handles[target_id]
+        return answer
 
     def _build_named_type_hash_template(self, template: Union[str, List[Any]]) -> List[Any]:
         if isinstance(template, str):
-            return ExpressionHasher.named_type_hash(template)
+            return self.named_type_registry.named_type_hash(template)
         else:
             return [self._build_named_type_hash_template(element) for element in template]
 
     def _build_named_type_template(self, composite_type: Union[str, List[Any]]) -> List[Any]:
         if isinstance(composite_type, str):
-            return self.named_type_table[composite_type]
+            return self.named_type_registry.named_type(composite_type)
         else:
             return [self._build_named_type_template(element) for element in composite_type]
 
@@ -56,17 +303,17 @@ class InMemoryDB(AtomDB):
             return
 
         self.all_named_types.add(_name)
-        name_hash = ExpressionHasher.named_type_hash(_name)
-        type_hash = ExpressionHasher.named_type_hash(_type)
-        typedef_mark_hash = ExpressionHasher.named_type_hash(":")
+        name_hash = self.named_type_registry.named_type_hash(_name)
+        type_hash = self.named_type_registry.named_type_hash(_type)
+        typedef_mark_hash = self.named_type_registry.typedef_mark_hash
 
-        key = ExpressionHasher.expression_hash(typedef_mark_hash, [name_hash, type_hash])
+        key = self.hasher.expression_hash(typedef_mark_hash, [name_hash, type_hash])
 
         atom_type = self.db.atom_type.get(key)
         if atom_type is None:
-            base_type_hash = ExpressionHasher.named_type_hash("Type")
+            base_type_hash = self.named_type_registry.base_type_hash
             composite_type = [typedef_mark_hash, type_hash, base_type_hash]
-            composite_type_hash = ExpressionHasher.composite_hash(composite_type)
+            composite_type_hash = self.named_type_registry.composite_type_hash(composite_type)
             atom_type = {
                 '_id': key,
                 'composite_type_hash': composite_type_hash,
@@ -74,64 +321,188 @@ class InMemoryDB(AtomDB):
                 'named_type_hash': name_hash,
             }
             self.db.atom_type[key] = atom_type
-            self.named_type_table[name_hash] = _name
 
-    def _add_outgoing_set(self, key: str, targets_hash: Dict[str, Any]) -> None:
-        self.db.outgoing_set[key] = targets_hash
+    @staticmethod
+    def _add_posting(index: Dict[Any, Any], key: Any, atom_id: int) -> None:
+        postings = index.get(key)
+        if postings is None:
+            index[key] = id_array((atom_id,))
+        else:
+            add_posting(postings, atom_id)
 
-    def _add_incomming_set(self, key: str, targets_hash: Dict[str, Any]) -> None:
-        for target_hash in targets_hash:
-            incomming_set = self.db.incomming_set.get(target_hash)
-            if incomming_set is None:
-                self.db.incomming_set[target_hash] = [key]
-            else:
-                self.db.incomming_set[target_hash].append(key)
+    @staticmethod
+    def _remove_posting(index: Dict[Any, Any], key: Any, atom_id: int) -> None:
+        postings = index.get(key)
+        if postings is not None and remove_posting(postings, atom_id) and not postings:
+            del index[key]
 
-    def _add_templates(
-        self,
-        composite_type_hash: str,
-        named_type_hash: str,
-        key: str,
-        targets_hash: List[str],
+    def _add_outgoing_set(self, link_id: int, target_ids: List[int]) -> None:
+        if self.columnar_links:
+            # The target columns of the link store are the outgoing set
+            return
+        self.db.outgoing_set[link_id] = id_array(target_ids)
+
+    def _update_toplevel_posting(
+        self, index: Dict[Any, Any], key: Any, link_id: int, toplevel: bool, was_toplevel: bool
     ) -> None:
-        template_composite_type_hash = self.db.templates.get(composite_type_hash)
-        template_named_type_hash = self.db.templates.get(named_type_hash)
+        if toplevel:
+            self._add_posting(index, key, link_id)
+        elif was_toplevel:
+            # The link was added again as a target of another link
+            self._remove_posting(index, key, link_id)
+
+    def _get_pattern_index_strategy(self, link_type: str) -> PatternIndexStrategy:
+        return self.link_type_pattern_index.get(link_type, self.pattern_index_strategy)
+
+    def _register_pattern_index(self, named_type: str, named_type_hash: str) -> None:
+        strategy = self._get_pattern_index_strategy(named_type)
+        if not isinstance(strategy, FullPatternIndex):
+            self.partial_pattern_index[named_type_hash] = strategy
+
+    @staticmethod
+    def _position_keys(named_type_hash: str, target_ids: List[int]) -> Iterator[Tuple]:
+        arity = len(target_ids)
+        for link_type_hash in [named_type_hash, WILDCARD]:
+            yield (link_type_hash, arity)
+            for position, target_id in enumerate(target_ids):
+                yield (link_type_hash, arity, position, target_id)
+
+    def _link_keys(
+        self, link: Dict[str, Any], target_ids: List[int]
+    ) -> List[Tuple[Dict[Any, Any], Iterable[Any], Optional[Dict[Any, Any]]]]:
+        """
+        Keys a link is posted to, as (index, keys, toplevel index) where the
+        toplevel index also gets the keys while the link is toplevel. Adding and
+        deleting links both use them.
+        """
+        encode = self.handle_codec.encode
+        named_type_hash = link['named_type_hash']
+        strategy = self._get_pattern_index_strategy(link['named_type'])
+        targets_hash = [self._handle(target_id) for target_id in target_ids]
+        pattern_keys = strategy.pattern_keys([named_type_hash, *targets_hash], self.hasher)
+        answer = [
+            (self.db.incomming_set, target_ids, None),
+            (
+                self.db.templates,
+                [encode(link['composite_type_hash']), encode(named_type_hash)],
+                self.db.toplevel_templates,
+            ),
+            (
+                self.db.patterns,
+                [encode(pattern_key) for pattern_key in pattern_keys],
+                self.db.toplevel_patterns,
+            ),
+        ]
+        if strategy.positional:
+            answer.append(
+                (self.db.positions, self._position_keys(named_type_hash, target_ids), None)
+            )
+        return answer
+
+    def _match_positions(self, link_type_hash: str, targets: List[Any]) -> List[int]:
+        arity = len(targets)
+        bound = [
+            (position, target) for position, target in enumerate(targets) if target != WILDCARD
+        ]
+        keys = [(link_type_hash, arity, position, target) for position, target in bound]
+        return intersect(
+            *[self.db.positions.get(key, ()) for key in keys or [(link_type_hash, arity)]]
+        )
 
-        if template_composite_type_hash is not None:
-            # template_composite_type_hash.append([key, targets_hash])
-            template_composite_type_hash.append((key, tuple(targets_hash)))
+    def _match_by_scan(self, link_type_hashes: set, targets: List[Any]) -> List[int]:
+        arity = len(targets)
+        bound = [
+            (position, target) for position, target in enumerate(targets) if target != WILDCARD
+        ]
+        if bound:
+            incomming_sets = [self.db.incomming_set.get(target, ()) for _, target in bound]
+            links = self.db.link.get_table(arity)
+            candidates = []
+            for link_id in intersect(*incomming_sets):
+                if (
+                    link_id in links
+                    and self.db.link.get_field(arity, link_id, 'named_type_hash')
+                    in link_type_hashes
+                ):
+                    candidates.append(link_id)
         else:
-            # self.db.templates[composite_type_hash] = [[key, targets_hash]]
-            self.db.templates[composite_type_hash] = [(key, tuple(targets_hash))]
+            encode = self.handle_codec.encode
+            candidates = union(
+                *[
+                    self.db.templates.get(encode(link_type_hash), ())
+                    for link_type_hash in link_type_hashes
+                ]
+            )
+        outgoing_set = self.db.outgoing_set
+        return [
+            link_id
+            for link_id in candidates
+            if len(outgoing_set[link_id]) == arity
+            and all(outgoing_set[link_id][position] == target for position, target in bound)
+        ]
 
-        if template_named_type_hash is not None:
-            # template_named_type_hash.append([key, targets_hash])
-            template_named_type_hash.append((key, tuple(targets_hash)))
+    def _match_not_indexed(self, link_type_hash: str, target_handles: List[str]) -> List[int]:
+        """Links matching the pattern whose strategy didn't post them to its key."""
+        pattern = [link_type_hash, *target_handles]
+        if link_type_hash == WILDCARD:
+            strategies = self.partial_pattern_index
+        elif link_type_hash in self.partial_pattern_index:
+            strategies = {link_type_hash: self.partial_pattern_index[link_type_hash]}
         else:
-            # self.db.templates[named_type_hash] = [[key, targets_hash]]
-            self.db.templates[named_type_hash] = [(key, tuple(targets_hash))]
-
-    def _add_patterns(self, named_type_hash: str, key: str, targets_hash: List[str]):
-        pattern_keys = build_patern_keys([named_type_hash, *targets_hash])
-
-        for pattern_key in pattern_keys:
-            pattern_key_hash = self.db.patterns.get(pattern_key)
-            if pattern_key_hash is not None:
-                # pattern_key_hash.append([key, targets_hash])
-                pattern_key_hash.append((key, tuple(targets_hash)))
-            else:
-                # self.db.patterns[pattern_key] = [[key, targets_hash]]
-                self.db.patterns[pattern_key] = [(key, tuple(targets_hash))]
-
-    def _filter_non_toplevel(self, matches: list) -> list:
+            return []
+        targets = [
+            handle if handle == WILDCARD else self._get_id(handle) for handle in target_handles
+        ]
+        if None in targets:
+            return []
+        positional = False
+        scanned = set()
+        for named_type_hash, strategy in strategies.items():
+            if strategy.positional:
+                positional = True
+            elif not strategy.indexes(pattern):
+                scanned.add(named_type_hash)
+        matches = self._match_positions(link_type_hash, targets) if positional else []
+        if scanned:
+            matches = union(matches, self._match_by_scan(scanned, targets))
+        return matches
+
+    def _filter_non_toplevel(self, link_ids: List[int]) -> List[int]:
         matches_toplevel_only = []
-        for match in matches:
-            link_handle = match[0]
-            links = self.db.link.get_table(len(match[-1]))
-            if links[link_handle]['is_toplevel']:
-                matches_toplevel_only.append(match)
+        for link_id in link_ids:
+            arity = len(self.db.outgoing_set[link_id])
+            if self.db.link.get_field(arity, link_id, 'is_toplevel'):
+                matches_toplevel_only.append(link_id)
         return matches_toplevel_only
 
+    def _build_match(self, link_id: int) -> Tuple[str, Tuple[str, ...]]:
+        handle = self._handle_getter()
+        return handle(link_id), tuple(map(handle, self.db.outgoing_set[link_id]))
+
+    def _build_matches(self, link_ids: Iterable[int]) -> list:
+        matches = self._matches
+        missing = [link_id for link_id in link_ids if link_id not in matches]
+        if missing:
+            # Built here rather than one by one by the cache, which is slower
+            if len(matches) + len(missing) > matches.size:
+                matches.clear()
+                if len(missing) > matches.size:
+                    # More than the cache keeps: built without keeping them
+                    matches, missing = {}, link_ids
+            handle = self._handle_getter()
+            outgoing_set = self.db.outgoing_set
+            for link_id in missing:
+                targets = outgoing_set[link_id]
+                if len(targets) == 2:  # most links, built without map()
+                    matches[link_id] = (handle(link_id), (handle(targets[0]), handle(targets[1])))
+                else:
+                    matches[link_id] = (handle(link_id), tuple(map(handle, targets)))
+        return list(map(matches.__getitem__, link_ids))
+
+    def _invalidate_results(self) -> None:
+        if self._results:
+            self._results.clear()
+
     def _build_targets_list(self, link: Dict[str, Any]):
         targets = []
         count = 0
@@ -143,30 +514,171 @@ class InMemoryDB(AtomDB):
             count += 1
         return targets
 
-    def _update_index(self, atom: Dict[str, Any]):
-        atom_type = atom['named_type']
-        self._add_atom_type(_name=atom_type)
-        if 'name' not in atom:
-            handle = atom['_id']
-            targets_hash = self._build_targets_list(atom)
-            self._add_atom_type(_name=atom_type)
-            self._add_outgoing_set(handle, targets_hash)
-            self._add_incomming_set(handle, targets_hash)
-            self._add_templates(
-                atom['composite_type_hash'],
-                atom['named_type_hash'],
-                handle,
-                targets_hash,
-            )
-            self._add_patterns(
-                atom['named_type_hash'],
-                handle,
-                targets_hash,
-            )
+    def _update_index(
+        self,
+        atom: Dict[str, Any],
+        atom_id: int,
+        target_ids: List[int] = None,
+        was_toplevel: bool = False,
+    ):
+        # atom is the document as exposed by the API (hex handles)
+        self._invalidate_results()
+        self._add_atom_type(_name=atom['named_type'])
+        if 'name' in atom:
+            self._add_posting(self.db.nodes_by_type, atom['composite_type_hash'], atom_id)
+            if self.db.node_names is not None:
+                self.db.node_names.add(atom['composite_type_hash'], atom_id, atom['name'])
+        else:
+            self._add_outgoing_set(atom_id, target_ids)
+            self._register_pattern_index(atom['named_type'], atom['named_type_hash'])
+            toplevel = atom['is_toplevel']
+            for index, keys, toplevel_index in self._link_keys(atom, target_ids):
+                for key in keys:
+                    self._add_posting(index, key, atom_id)
+                    if toplevel_index is not None:
+                        self._update_toplevel_posting(
+                            toplevel_index, key, atom_id, toplevel, was_toplevel
+                        )
+
+    def _index_pending(self) -> None:
+        """Indexes the atoms added in bulk_load(), grouping the postings of each key."""
+        if not self._pending_nodes and not self._pending_links:
+            return
+        nodes, links = self._pending_nodes, self._pending_links
+        self._pending_nodes, self._pending_links = {}, {}
+        self._invalidate_results()
+        # Postings to add, by index (by identity, as dicts aren't hashable) and key.
+        # Atoms are visited by id so each list is built sorted.
+        batches: Dict[int, Tuple[Dict[Any, Any], Dict[Any, List[int]]]] = {}
+
+        def post(index: Dict[Any, Any], keys: Iterable[Any], atom_id: int) -> None:
+            entry = batches.get(id(index))
+            if entry is None:
+                entry = batches[id(index)] = (index, {})
+            postings = entry[1]
+            for key in keys:
+                atom_ids = postings.get(key)
+                if atom_ids is None:
+                    postings[key] = [atom_id]
+                elif atom_ids[-1] != atom_id:
+                    atom_ids.append(atom_id)
+
+        named_types = set()
+        for node_id in sorted(nodes):
+            node = nodes[node_id]
+            named_types.add(node['named_type'])
+            post(self.db.nodes_by_type, [node['composite_type_hash']], node_id)
+            if self.db.node_names is not None:
+                self.db.node_names.add(node['composite_type_hash'], node_id, node['name'])
+        for link_id in sorted(links):
+            link, target_ids, was_toplevel = links[link_id]
+            named_types.add(link['named_type'])
+            self._register_pattern_index(link['named_type'], link['named_type_hash'])
+            for index, keys, toplevel_index in self._link_keys(link, target_ids):
+                keys = list(keys)
+                post(index, keys, link_id)
+                if toplevel_index is None:
+                    continue
+                if link['is_toplevel']:
+                    post(toplevel_index, keys, link_id)
+                elif was_toplevel:
+                    for key in keys:
+                        self._remove_posting(toplevel_index, key, link_id)
+        for named_type in named_types:
+            self._add_atom_type(_name=named_type)
+        for index, postings in batches.values():
+            for key, atom_ids in postings.items():
+                current = index.get(key)
+                if current is None:
+                    index[key] = id_array(atom_ids)
+                else:
+                    add_postings(current, atom_ids)
+
+    @contextmanager
+    def bulk_load(self) -> Iterator[None]:
+        """
+        Atoms added inside the block are stored right away, but indexed only when
+        it ends (even if it raises), in one pass. Until then queries by type,
+        template or pattern don't see them. Blocks can be nested; the outermost
+        one indexes. With thread_safe the write lock is held for the whole block.
+
+        The cyclic garbage collector is paused meanwhile: a load allocates millions
+        of containers without cycles and its passes over them would take a good
+        part of the time.
+        """
+        if self._pending_nodes is not None:
+            yield
+            return
+        with self._lock.write() if self._lock is not None else nullcontext():
+            self._thaw()
+            gc_enabled = gc.isenabled()
+            gc.disable()
+            self._pending_nodes, self._pending_links = {}, {}
+            try:
+                yield
+            finally:
+                try:
+                    self._index_pending()
+                finally:
+                    self._pending_nodes, self._pending_links = None, None
+                    if gc_enabled:
+                        gc.enable()
+
+    def add_atoms(self, atoms: Iterable[Dict[str, Any]]) -> None:
+        """
+        Adds nodes and (toplevel) links, told apart by their "targets" field,
+        inside a bulk_load() block.
+        """
+        with self.bulk_load():
+            for atom in atoms:
+                if 'targets' in atom:
+                    self.add_link(atom)
+                else:
+                    self.add_node(atom)
+
+    def _delete_node(self, node_id: int) -> None:
+        node = self.db.node.pop(node_id)
+        self._remove_posting(self.db.nodes_by_type, node['composite_type_hash'], node_id)
+        if self.db.node_names is not None:
+            self.db.node_names.remove(node['composite_type_hash'], node_id, node['name'])
+
+    def _delete_link(self, link_id: int, kind: AtomKind) -> None:
+        # The keys of the link are computed again, as when it was added
+        link = self.db.link.get_table(kind.bucket_arity)[link_id]
+        target_ids = list(self.db.outgoing_set[link_id])
+        for index, keys, toplevel_index in self._link_keys(link, target_ids):
+            for key in keys:
+                self._remove_posting(index, key, link_id)
+                if toplevel_index is not None:
+                    self._remove_posting(toplevel_index, key, link_id)
+        self.db.link.remove(link_id, kind.bucket_arity)
+        if not self.columnar_links:
+            del self.db.outgoing_set[link_id]
+        self._matches.pop(link_id, None)
+
+    def _delete_atom(self, atom_id: int, kind: AtomKind, recursive: bool) -> None:
+        self._invalidate_results()
+        incomming_set = self.db.incomming_set.get(atom_id)
+        if incomming_set:
+            if not recursive:
+                raise InvalidOperationException(
+                    message='This atom is a target of other links',
+                    details=f'handle: {self._handle(atom_id)}',
+                )
+            for link_id in list(incomming_set):
+                link_kind = self.db.directory.kind(link_id)
+                if link_kind is not None:
+                    self._delete_atom(link_id, link_kind, recursive)
+        if kind == AtomKind.NODE:
+            self._delete_node(atom_id)
+        else:
+            self._delete_link(atom_id, kind)
+        self.db.directory.remove(atom_id)
 
+    @read_locked
     def get_node_handle(self, node_type: str, node_name: str) -> str:
         node_handle = self.node_handle(node_type, node_name)
-        if node_handle in self.db.node:
+        if self._get_id(node_handle) in self.db.node:
             return node_handle
         else:
             raise NodeDoesNotExist(
@@ -174,8 +686,9 @@ class InMemoryDB(AtomDB):
                 details=f'{node_type}:{node_name}',
             )
 
+    @read_locked
     def get_node_name(self, node_handle: str) -> str:
-        node = self.db.node.get(node_handle)
+        node = self.db.node.get(self._get_id(node_handle))
         if node is None:
             raise NodeDoesNotExist(
                 message='This node does not exist',
@@ -183,43 +696,45 @@ class InMemoryDB(AtomDB):
             )
         return node['name']
 
+    @read_locked
     def get_node_type(self, node_handle: str) -> str:
-        node = self.db.node.get(node_handle)
-        if node is None:
+        node_type = self._get_atom_type(node_handle, link=False)
+        if node_type is None:
             raise NodeDoesNotExist(
                 message='This node does not exist',
                 details=f'node_handle: {node_handle}',
             )
-        return node['named_type']
-
-    def get_matched_node_name(self, node_type: str, substring: Optional[str] = '') -> str:
-        node_type_hash = ExpressionHasher.named_type_hash(node_type)
-
-        return [
-            key
-            for key, value in self.db.node.items()
-            if substring in value['name'] and node_type_hash == value['composite_type_hash']
-        ]
+        return node_type
+
+    @read_locked
+    def get_matched_node_name(self, node_type: str, substring: Optional[str] = '') -> Iterator[str]:
+        node_type_hash = self.named_type_registry.named_type_hash(node_type)
+        nodes = self.db.node
+
+        node_ids = None
+        if self.db.node_names is not None:
+            node_ids = self.db.node_names.candidates(node_type_hash, substring)
+        if node_ids is None:
+            node_ids = self.db.nodes_by_type.get(node_type_hash, ())
+        return (
+            self._handle(node_id) for node_id in node_ids if substring in nodes[node_id]['name']
+        )
 
-    def get_all_nodes(self, node_type: str, names: bool = False) -> List[str]:
-        node_type_hash = ExpressionHasher.named_type_hash(node_type)
+    @read_locked
+    def get_all_nodes(self, node_type: str, names: bool = False) -> Iterator[str]:
+        node_type_hash = self.named_type_registry.named_type_hash(node_type)
+        node_ids = self.db.nodes_by_type.get(node_type_hash, ())
 
         if names:
-            return [
-                value['name']
-                for value in self.db.node.values()
-                if value['composite_type_hash'] == node_type_hash
-            ]
+            nodes = self.db.node
+            return (nodes[node_id]['name'] for node_id in node_ids)
         else:
-            return [
-                key
-                for key, value in self.db.node.items()
-                if value['composite_type_hash'] == node_type_hash
-            ]
+            return map(self._handle_getter(), node_ids)
 
+    @read_locked
     def get_link_handle(self, link_type: str, target_handles: List[str]) -> str:
         link_handle = self.link_handle(link_type, target_handles)
-        if link_handle in self.db.link.get_table(len(target_handles)):
+        if self._get_id(link_handle) in self.db.link.get_table(len(target_handles)):
             return link_handle
         else:
             raise LinkDoesNotExist(
@@ -227,28 +742,31 @@ class InMemoryDB(AtomDB):
                 details=f'{link_type}:{target_handles}',
             )
 
+    @read_locked
     def get_link_type(self, link_handle: str) -> str:
-        link = self._get_link(link_handle)
-        if link is not None:
-            return link['named_type']
+        link_type = self._get_atom_type(link_handle, link=True)
+        if link_type is not None:
+            return link_type
         else:
             raise LinkDoesNotExist(
                 message='This link does not exist',
                 details=f'link_handle: {link_handle}',
             )
 
+    @read_locked
     def get_link_targets(self, link_handle: str) -> List[str]:
-        answer = self.db.outgoing_set.get(link_handle)
+        answer = self.db.outgoing_set.get(self._get_id(link_handle))
         if answer is None:
             raise LinkDoesNotExist(
                 message='This link does not exist',
                 details=f'link_handle: {link_handle}',
             )
-        return answer
+        return list(map(self._handle_getter(), answer))
 
+    @read_locked
     def is_ordered(self, link_handle: str) -> bool:
-        link = self._get_link(link_handle)
-        if link is not None:
+        kind = self.db.directory.kind(self._get_id(link_handle))
+        if kind is not None and kind != AtomKind.NODE:
             return True
         else:
             raise LinkDoesNotExist(
@@ -256,6 +774,44 @@ class InMemoryDB(AtomDB):
                 details=f'link_handle: {link_handle}',
             )
 
+    @staticmethod
+    def _toplevel_only(extra_parameters: Optional[Dict[str, Any]]) -> bool:
+        return bool(extra_parameters and extra_parameters.get('toplevel_only'))
+
+    def _templates_index(self, extra_parameters: Optional[Dict[str, Any]]) -> Dict[Any, Any]:
+        if self._toplevel_only(extra_parameters):
+            return self.db.toplevel_templates
+        return self.db.templates
+
+    def _build_page(
+        self,
+        link_ids: List[int],
+        extra_parameters: Optional[Dict[str, Any]],
+        cache_key: Optional[Tuple[Any, ...]] = None,
+    ) -> Union[list, Tuple[int, list]]:
+        """
+        Matches of the links, or a page of them. Whole lists are kept by
+        cache_key (the index and key they were read from) until the next write.
+        """
+        page_request = self._page_request(extra_parameters)
+        if page_request is None:
+            if cache_key is None or len(link_ids) > self._matches.size:
+                return self._build_matches(link_ids)
+            answer = self._results.get(cache_key)
+            if answer is None:
+                answer = self._build_matches(link_ids)
+                if not self.result_cache_size:
+                    return answer
+                if len(self._results) >= self.result_cache_size:
+                    self._results.clear()
+                self._results[cache_key] = answer
+            # The caller may change the list
+            return list(answer)
+        cursor, page_size = page_request
+        next_cursor, page_ids = page(link_ids, cursor, page_size)
+        return next_cursor, self._build_matches(page_ids)
+
+    @read_locked
     def get_matched_links(
         self,
         link_type: str,
@@ -264,12 +820,14 @@ class InMemoryDB(AtomDB):
     ) -> list:
         if link_type != WILDCARD and WILDCARD not in target_handles:
             link_handle = self.get_link_handle(link_type, target_handles)
+            if self._page_request(extra_parameters) is not None:
+                return 0, [link_handle]
             return [link_handle]
 
         if link_type == WILDCARD:
             link_type_hash = WILDCARD
         else:
-            link_type_hash = ExpressionHasher.named_type_hash(link_type)
+            link_type_hash = self.named_type_registry.named_type_hash(link_type)
 
         if link_type in UNORDERED_LINK_TYPES:
             target_handles = sorted(target_handles)
@@ -278,45 +836,54 @@ class InMemoryDB(AtomDB):
                 details=f'link_type: {link_type}',
             )
 
-        pattern_hash = ExpressionHasher.composite_hash([link_type_hash, *target_handles])
-
-        patterns_matched = self.db.patterns.get(pattern_hash, [])
+        pattern_hash = self.hasher.composite_hash([link_type_hash, *target_handles])
 
-        if len(patterns_matched) > 0:
-            if extra_parameters and extra_parameters.get('toplevel_only'):
-                return self._filter_non_toplevel(patterns_matched)
+        toplevel_only = self._toplevel_only(extra_parameters)
+        patterns = self.db.toplevel_patterns if toplevel_only else self.db.patterns
+        patterns_matched = patterns.get(self.handle_codec.encode(pattern_hash), ())
+        cache_key = ('patterns', toplevel_only, pattern_hash)
+        if self.partial_pattern_index:
+            not_indexed = self._match_not_indexed(link_type_hash, target_handles)
+            if not_indexed and toplevel_only:
+                not_indexed = self._filter_non_toplevel(not_indexed)
+            if not_indexed:
+                patterns_matched = union(patterns_matched, not_indexed)
+                cache_key = None
 
-        return patterns_matched
+        return self._build_page(patterns_matched, extra_parameters, cache_key)
 
+    @read_locked
     def get_matched_type_template(
         self,
         template: List[Any],
         extra_parameters: Optional[Dict[str, Any]] = None,
     ) -> List[str]:
         template = self._build_named_type_hash_template(template)
-        template_hash = ExpressionHasher.composite_hash(template)
-        templates_matched = self.db.templates.get(template_hash, [])
-        if len(templates_matched) > 0:
-            if extra_parameters and extra_parameters.get('toplevel_only'):
-                return self._filter_non_toplevel(templates_matched)
-        return templates_matched
+        template_hash = self.hasher.composite_hash(template)
+        templates = self._templates_index(extra_parameters)
+        templates_matched = templates.get(self.handle_codec.encode(template_hash), ())
+        cache_key = ('templates', self._toplevel_only(extra_parameters), template_hash)
+        return self._build_page(templates_matched, extra_parameters, cache_key)
 
+    @read_locked
     def get_matched_type(
         self, link_type: str, extra_parameters: Optional[Dict[str, Any]] = None
     ) -> List[str]:
-        link_type_hash = ExpressionHasher.named_type_hash(link_type)
-        templates_matched = self.db.templates.get(link_type_hash, [])
-        if len(templates_matched) > 0:
-            if extra_parameters and extra_parameters.get('toplevel_only'):
-                return self._filter_non_toplevel(templates_matched)
-        return templates_matched
+        link_type_hash = self.named_type_registry.named_type_hash(link_type)
+        templates = self._templates_index(extra_parameters)
+        templates_matched = templates.get(self.handle_codec.encode(link_type_hash), ())
+        cache_key = ('templates', self._toplevel_only(extra_parameters), link_type_hash)
+        return self._build_page(templates_matched, extra_parameters, cache_key)
 
+    @read_locked
     def get_atom(self, handle: str) -> Dict[str, Any]:
-        document = self.db.node.get(handle)
-        if document is None:
-            document = self._get_link(handle)
+        atom_id = self._get_id(handle)
+        if self.db.directory.kind(atom_id) == AtomKind.NODE:
+            document = self.db.node[atom_id]
+        else:
+            document = self._get_link(atom_id)
         if document:
-            atom = self._convert_atom_format(document)
+            atom = self._convert_atom_format(self.handle_codec.decode_document(document))
             return atom
         else:
             raise AtomDoesNotExist(
@@ -324,27 +891,30 @@ class InMemoryDB(AtomDB):
                 details=f'handle: {handle}',
             )
 
+    @read_locked
     def get_atom_as_dict(self, handle: str, arity: Optional[int] = 0) -> Dict[str, Any]:
-        atom = self.db.node.get(handle)
-        if atom is not None:
+        atom_id = self._get_id(handle)
+        if self.db.directory.kind(atom_id) == AtomKind.NODE:
+            atom = self.db.node[atom_id]
             return {
-                'handle': atom['_id'],
+                'handle': handle,
                 'type': atom['named_type'],
                 'name': atom['name'],
             }
-        atom = self._get_link(handle)
+        atom = self._get_link(atom_id)
         if atom is not None:
             return {
-                'handle': atom['_id'],
+                'handle': handle,
                 'type': atom['named_type'],
                 'template': self._build_named_type_template(atom['composite_type']),
-                'targets': self._build_targets_list(atom),
+                'targets': list(map(self._handle_getter(), self.db.outgoing_set[atom_id])),
             }
         raise AtomDoesNotExist(
             message='This atom does not exist',
             details=f'handle: {handle}',
         )
 
+    @read_locked
     def count_atoms(self) -> Tuple[int, int]:
         nodes = len(self.db.node)
         links = 0
@@ -352,28 +922,85 @@ class InMemoryDB(AtomDB):
             links += len(table)
         return (nodes, links)
 
+    @read_locked
+    def memory_stats(self, sample_size: int = DEFAULT_SAMPLE_SIZE) -> Dict[str, Any]:
+        """
+        Estimated memory of the database: entries, postings and bytes of every
+        index and atom table, and links and bytes by link type (see
+        utils.memory.memory_stats). Atom tables are estimated from sample_size
+        documents, so it's cheap enough to call periodically. mapped_bytes is the
+        size of the snapshot the database is read from, if any. caches has the
+        entries and bytes of the query caches, which are counted in bytes too.
+        """
+        mapped_bytes = len(self._snapshot.mapping) if self._snapshot is not None else 0
+        stats = memory_stats(self.db, sample_size, mapped_bytes)
+        caches = {
+            'handles': cache_stats(self._handles, sample_size),
+            'matches': cache_stats(self._matches, sample_size),
+            'results': cache_stats(self._results, sample_size),
+        }
+        stats['caches'] = caches
+        stats['bytes'] += sum(cache['bytes'] for cache in caches.values())
+        return stats
+
+    @write_locked
     def clear_database(self) -> None:
-        self.named_type_table = {}
-        self.db = Database(
-            atom_type={},
-            node={},
-            link=Link(arity_1={}, arity_2={}, arity_n={}),
-            outgoing_set={},
-            incomming_set={},
-            patterns={},
-            templates={},
-            names={},
-        )
+        self.all_named_types = set()
+        self.partial_pattern_index = {}
+        self._snapshot = None
+        if self._pending_nodes is not None:
+            self._pending_nodes, self._pending_links = {}, {}
+        self.db = self._new_database()
+        self._handles.clear()
+        self._matches.clear()
+        self._invalidate_results()
+
+    @write_locked
+    def delete_atom(self, handle: str, recursive: bool = False) -> None:
+        self._thaw()
+        self._index_pending()
+        atom_id = self._get_id(handle)
+        kind = self.db.directory.kind(atom_id)
+        if kind is None:
+            raise AtomDoesNotExist(
+                message='This atom does not exist',
+                details=f'handle: {handle}',
+            )
+        self._delete_atom(atom_id, kind, recursive)
 
+    @write_locked
     def add_node(self, node_params: Dict[str, Any]) -> Dict[str, Any]:
+        self._thaw()
         handle, node = self._add_node(node_params)
-        self.db.node[handle] = node
-        self._update_index(node)
+        node_id = self._intern(handle)
+        self.db.node[node_id] = self._build_document(node_id, node, [])
+        self.db.directory.add(node_id, AtomKind.NODE, node['named_type'])
+        if self._pending_nodes is not None:
+            self._pending_nodes[node_id] = node
+        else:
+            self._update_index(node, node_id)
         return node
 
+    @write_locked
     def add_link(self, link_params: Dict[str, Any], toplevel: bool = True) -> Dict[str, Any]:
+        self._thaw()
         handle, link, targets = self._add_link(link_params, toplevel)
-        link_db = self.db.link.get_table(len(targets))
-        link_db[handle] = link
-        self._update_index(link)
+        link_id = self._intern(handle)
+        target_ids = [self._intern(target) for target in targets]
+        kind = self.db.directory.kind(link_id)
+        was_toplevel = kind is not None and self.db.link.get_field(
+            kind.bucket_arity, link_id, 'is_toplevel'
+        )
+        self.db.link.add(link_id, self._build_document(link_id, link, target_ids), target_ids)
+        self.db.directory.add(link_id, AtomKind.of_arity(len(targets)), link['named_type'])
+        if self._pending_links is not None:
+            # The outgoing set is kept up to date, as the link store is
+            self._add_outgoing_set(link_id, target_ids)
+            pending = self._pending_links.get(link_id)
+            if pending is not None:
+                # It was toplevel before the block as when it was first added in it
+                was_toplevel = pending[2]
+            self._pending_links[link_id] = (link, target_ids, was_toplevel)
+        else:
+            self._update_index(link, link_id, target_ids, was_toplevel)
         return link
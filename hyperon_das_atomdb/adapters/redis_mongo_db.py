@@ -1,15 +1,23 @@
 import pickle
-import sys
+import queue
+import re
+import threading
+import time
+from collections import defaultdict
+from concurrent.futures import ThreadPoolExecutor
 from enum import Enum
-from typing import Any, Dict, Iterable, List, Optional, Tuple, Union
+from typing import Any, Dict, Iterable, Iterator, List, Optional, Tuple, Union
 
-from pymongo import MongoClient
+import bson
+from pymongo import ASCENDING, MongoClient
 from pymongo.database import Database
 from pymongo.errors import BulkWriteError
 from redis import Redis
 from redis.cluster import RedisCluster
+from redis.exceptions import ResponseError
 
 from hyperon_das_atomdb.database import UNORDERED_LINK_TYPES, WILDCARD, AtomDB
+from hyperon_das_atomdb.entity import AtomKind
 from hyperon_das_atomdb.exceptions import (
     AtomDoesNotExist,
     ConnectionMongoDBException,
@@ -19,9 +27,21 @@ from hyperon_das_atomdb.exceptions import (
 )
 from hyperon_das_atomdb.logger import logger
 from hyperon_das_atomdb.utils.expression_hasher import ExpressionHasher
+from hyperon_das_atomdb.utils.handles import handle_codec
+from hyperon_das_atomdb.utils.members import MEMBER_VERSION, decode_member, encode_member
+from hyperon_das_atomdb.utils.patterns import iter_pattern_keys
+
+
+def _directory_bucket_digits(expected_atoms: int) -> int:
+    digits = 1
+    while expected_atoms > DIRECTORY_BUCKET_ENTRIES * 16**digits:
+        digits += 1
+    return digits
 
 
 def _build_redis_key(prefix, key):
+    if isinstance(key, bytes):
+        return prefix.encode() + b":" + key
     return prefix + ":" + key
 
 
@@ -31,6 +51,7 @@ class MongoCollectionNames(str, Enum):
     LINKS_ARITY_1 = 'links_1'
     LINKS_ARITY_2 = 'links_2'
     LINKS_ARITY_N = 'links_n'
+    METADATA = 'metadata'
 
 
 class MongoFieldNames(str, Enum):
@@ -49,7 +70,88 @@ class KeyPrefix(str, Enum):
     OUTGOING_SET = 'outgoing_set'
     PATTERNS = 'patterns'
     TEMPLATES = 'templates'
+    TOPLEVEL_PATTERNS = 'toplevel_patterns'
+    TOPLEVEL_TEMPLATES = 'toplevel_templates'
     NAMED_ENTITIES = 'names'
+    NAME_SEARCH = 'name_search'
+    ATOM_DIRECTORY = 'atoms'
+
+
+# Pattern and template keys holding only the toplevel links, read by toplevel_only
+# queries
+TOPLEVEL_PREFIXES = {
+    KeyPrefix.PATTERNS: KeyPrefix.TOPLEVEL_PATTERNS,
+    KeyPrefix.TEMPLATES: KeyPrefix.TOPLEVEL_TEMPLATES,
+}
+
+HASH_SCHEME_METADATA_ID = 'hash_scheme'
+
+# Handle directory entries (kind byte followed by the type hash digest) are grouped
+# in Redis hashes by the leading hex digits of the handle. Redis only encodes a hash
+# compactly up to hash-max-listpack-entries fields (128 by default), so a new
+# database takes enough digits for at most DIRECTORY_BUCKET_ENTRIES atoms per hash,
+# on average, at its expected_atoms. The digits are recorded in the metadata.
+DIRECTORY_BUCKET_ENTRIES = 100
+# Digits without expected_atoms, or in metadata written before they were recorded:
+# 65,536 hashes, compact up to about 6 million atoms
+DIRECTORY_BUCKET_DIGITS = 4
+
+# Ceilings of a collection buffer, written when it reaches either. The driver splits
+# the batches in messages Mongo accepts (48MB and 100000 documents at most).
+BULK_INSERTION_LIMIT = 100000
+BULK_INSERTION_BYTES = 32 * 1024 * 1024
+# Lower bound of the byte budget of a collection when it adapts to commit_latency.
+# Smaller writes are dominated by round trips and don't tell the write rate.
+MIN_BULK_INSERTION_BYTES = 1024 * 1024
+
+# Largest BSON document Mongo stores
+MAX_MONGO_DOCUMENT_SIZE = 16 * 1024 * 1024
+# Bytes counted per list item by _document_size
+DOCUMENT_ITEM_BYTES = 40
+
+# Full buffers waiting for the background writer, with async_flush. Adding atoms
+# blocks while the queue is full.
+FLUSH_QUEUE_SIZE = 2
+
+# Documents of a buffer inserted at once when committing with commit_workers > 1. The
+# Redis indexes of a chunk are written while the next chunk is inserted in Mongo.
+COMMIT_CHUNK_SIZE = 10000
+
+# Commands sent by each pipeline round trip when indexing committed links
+REDIS_PIPELINE_SIZE = 10000
+
+# Number of link handles checked by each query when filtering toplevel matches
+TOPLEVEL_FILTER_BATCH_SIZE = 1000
+
+# RediSearch index over the name_search:<handle> hashes (name and type of each node)
+NAME_SEARCH_INDEX = 'name_search'
+NAME_SEARCH_BATCH_SIZE = 1000
+# Prefix and substring queries need at least this many characters in RediSearch
+NAME_SEARCH_MIN_TERM_SIZE = 2
+NAME_MATCH_MODES = ['substring', 'prefix', 'token']
+
+
+def _document_size(document: Dict[str, Any]) -> int:
+    """
+    Estimate of the BSON size of a document from the lengths of its keys and
+    string values, with a fixed size per list item and per other value. It's
+    several times cheaper than encoding the document.
+    """
+    size = 5
+    for key, value in document.items():
+        size += len(key) + 2
+        if isinstance(value, (str, bytes)):
+            size += len(value) + 5
+        elif isinstance(value, (list, tuple, dict)):
+            size += 5 + DOCUMENT_ITEM_BYTES * len(value)
+        else:
+            size += 8
+    return size
+
+
+def _escape_search_term(term: str) -> str:
+    # Punctuation and spaces are special characters in RediSearch queries
+    return ''.join(char if char.isalnum() or char == '_' else '\\' + char for char in term)
 
 
 class NodeDocuments:
@@ -57,9 +159,12 @@ class NodeDocuments:
         self.mongo_collection = collection
         self.cached_nodes = {}
         self.count = 0
+        # Nodes may be committed by several threads
+        self._lock = threading.Lock()
 
-    def add(self) -> None:
-        self.count += 1
+    def add(self, count: int = 1) -> None:
+        with self._lock:
+            self.count += count
 
     def get(self, handle, default_value):
         mongo_filter = {MongoFieldNames.ID_HASH: handle}
@@ -86,7 +191,26 @@ class _HashableDocument:
 
 
 class RedisMongoDB(AtomDB):
-    """A concrete implementation using Redis and Mongo database"""
+    """
+    A concrete implementation using Redis and Mongo database
+
+    Added atoms are buffered per collection and written (to Mongo, then indexed in
+    Redis) by commit(), or when a buffer reaches mongo_bulk_insertion_limit
+    documents or mongo_bulk_insertion_bytes of BSON. With commit_latency (seconds),
+    the byte budget of each collection follows the write rate measured by its
+    last write, so that writing a buffer takes about that long. With
+    async_flush, full buffers are swapped for empty ones and written by a
+    background thread, through a queue of flush_queue_size buffers, so parsing
+    and hashing overlap with the writes. commit() then waits for them, and
+    flush() waits without handing over the buffers being filled. Errors of the
+    background writes are raised by the next hand over, flush() or commit(), and
+    the buffers that failed are added back to be written by the next commit().
+    close() commits and stops the background writers and the commit_workers pools.
+
+    With commit_workers > 1 the collections are written in parallel by that many
+    threads (background writers, with async_flush), and the Mongo inserts and
+    Redis indexing of each collection overlap, chunk by chunk.
+    """
 
     def __repr__(self) -> str:
         return "<Atom database RedisMongo>"  # pragma no cover
@@ -96,6 +220,11 @@ class RedisMongoDB(AtomDB):
         Initialize an instance of a custom class with Redis and MongoDB connections.
         """
         self.database_name = 'das'
+        self.handle_codec = handle_codec(kwargs.get('compact_handles', False))
+        # Writes pattern and template members pickled, as readers before the binary
+        # members expect. Both are read.
+        self.legacy_members = kwargs.get('legacy_members', False)
+        self.redis_name_search = kwargs.get('redis_name_search', False)
         self._setup_databases(**kwargs)
         self.mongo_link_collection = {
             "1": self.mongo_db.get_collection(MongoCollectionNames.LINKS_ARITY_1),
@@ -120,9 +249,16 @@ class RedisMongoDB(AtomDB):
             (MongoCollectionNames.NODES, self.mongo_nodes_collection),
             (MongoCollectionNames.ATOM_TYPES, self.mongo_types_collection),
         ]
-        self.wildcard_hash = ExpressionHasher._compute_hash(WILDCARD)
-        self.named_type_hash = None
-        self.named_type_hash_reverse = None
+        self.mongo_metadata_collection = self.mongo_db.get_collection(MongoCollectionNames.METADATA)
+        self._setup_indexes()
+        if self.redis_name_search:
+            self._setup_name_search()
+        # Sizes the handle directory of a new database (see DIRECTORY_BUCKET_ENTRIES)
+        self.expected_atoms = kwargs.get('expected_atoms')
+        self._setup_hash_scheme(kwargs.get('hash_scheme'))
+        self.wildcard_hash = self.hasher._compute_hash(WILDCARD)
+        self.named_type_registry = self.hasher.named_types
+        # Name of the parent type of each named type, read by prefetch()
         self.named_types = None
         self.symbol_hash = None
         self.parent_type = None
@@ -130,22 +266,37 @@ class RedisMongoDB(AtomDB):
         self.terminal_hash = None
         self.link_type_cache = None
         self.node_type_cache = None
-        self.typedef_mark_hash = ExpressionHasher._compute_hash(":")
-        self.typedef_base_type_hash = ExpressionHasher._compute_hash("Type")
-        self.typedef_composite_type_hash = ExpressionHasher.composite_hash(
-            [
-                self.typedef_mark_hash,
-                self.typedef_base_type_hash,
-                self.typedef_base_type_hash,
-            ]
-        )
-        self.use_targets = [KeyPrefix.PATTERNS, KeyPrefix.TEMPLATES]
+        self.typedef_mark_hash = self.named_type_registry.typedef_mark_hash
+        self.typedef_base_type_hash = self.named_type_registry.base_type_hash
+        self.typedef_composite_type_hash = self.named_type_registry.typedef_composite_type_hash
+        self.use_targets = [KeyPrefix.PATTERNS, KeyPrefix.TEMPLATES, *TOPLEVEL_PREFIXES.values()]
         self.mongo_bulk_insertion_buffer = {
             collection_name: tuple([collection, set()])
             for collection_name, collection in self.all_mongo_collections
         }
-        self.mongo_bulk_insertion_limit = 100000
-        self.max_mongo_db_document_size = 16000000
+        self.mongo_bulk_insertion_limit = kwargs.get(
+            'mongo_bulk_insertion_limit', BULK_INSERTION_LIMIT
+        )
+        self.mongo_bulk_insertion_bytes = kwargs.get(
+            'mongo_bulk_insertion_bytes', BULK_INSERTION_BYTES
+        )
+        self.commit_latency = kwargs.get('commit_latency')
+        self.max_mongo_db_document_size = MAX_MONGO_DOCUMENT_SIZE
+        # BSON bytes of each buffer, and the byte budgets adapted to commit_latency
+        self._buffer_bytes = {name: 0 for name, _ in self.all_mongo_collections}
+        self._batch_bytes: Dict[str, int] = {}
+        self.async_flush = kwargs.get('async_flush', False)
+        self._flush_queue = queue.Queue(maxsize=kwargs.get('flush_queue_size', FLUSH_QUEUE_SIZE))
+        self._flush_workers: List[threading.Thread] = []
+        self._flush_error: Optional[Exception] = None
+        # Buffers the background writers failed to write, with their BSON bytes
+        self._failed_buffers: List[Tuple[str, set, int]] = []
+        self._flush_lock = threading.Lock()
+        self.commit_workers = kwargs.get('commit_workers', 1)
+        # Created on the first parallel commit. Indexing has its own pool since
+        # collection writes wait for it.
+        self._commit_pool: Optional[ThreadPoolExecutor] = None
+        self._index_pool: Optional[ThreadPoolExecutor] = None
         logger().info("Prefetching data")
         self.prefetch()
         logger().info("Database setup finished")
@@ -241,18 +392,90 @@ class RedisMongoDB(AtomDB):
 
         return self.redis
 
+    def _setup_indexes(self) -> None:
+        # Nodes of a type (with their names) are read from this index alone
+        self.mongo_nodes_collection.create_index(
+            [
+                (MongoFieldNames.TYPE.value, ASCENDING),
+                (MongoFieldNames.NODE_NAME.value, ASCENDING),
+                (MongoFieldNames.ID_HASH.value, ASCENDING),
+            ]
+        )
+
+    def _setup_name_search(self) -> None:
+        # The name is indexed both as a single tag (substring and prefix queries)
+        # and as text (token queries)
+        try:
+            self.redis.execute_command(
+                'FT.CREATE',
+                NAME_SEARCH_INDEX,
+                'ON',
+                'HASH',
+                'PREFIX',
+                '1',
+                f'{KeyPrefix.NAME_SEARCH.value}:',
+                'SCHEMA',
+                'name',
+                'TAG',
+                'SEPARATOR',
+                '\x1f',
+                'CASESENSITIVE',
+                'WITHSUFFIXTRIE',
+                'name',
+                'AS',
+                'name_tokens',
+                'TEXT',
+                'NOSTEM',
+                'type',
+                'TAG',
+            )
+        except ResponseError as exception:
+            if 'already exists' not in str(exception):
+                logger().warning(f'Redis name search disabled: {exception}')
+                self.redis_name_search = False
+
+    def _setup_hash_scheme(self, hash_scheme: Optional[str]) -> None:
+        metadata = self.mongo_metadata_collection.find_one(
+            {MongoFieldNames.ID_HASH: HASH_SCHEME_METADATA_ID}
+        )
+        if metadata is None:
+            self.hasher = ExpressionHasher.for_scheme(hash_scheme)
+            self.directory_bucket_digits = (
+                DIRECTORY_BUCKET_DIGITS
+                if self.expected_atoms is None
+                else _directory_bucket_digits(self.expected_atoms)
+            )
+            # Links loaded before have no toplevel partitions
+            self.toplevel_partitions = self.mongo_nodes_collection.find_one({}) is None
+            if not self.toplevel_partitions:
+                # Data loaded before hash schemes were recorded is MD5
+                self._check_hash_scheme({})
+            self._write_metadata()
+        else:
+            self.hasher = ExpressionHasher.for_scheme(hash_scheme or metadata['hash_scheme'])
+            self._check_hash_scheme(metadata)
+            self.toplevel_partitions = metadata.get('toplevel_partitions', False)
+            self.directory_bucket_digits = metadata.get(
+                'directory_bucket_digits', DIRECTORY_BUCKET_DIGITS
+            )
+
+    def _write_metadata(self) -> None:
+        self.mongo_metadata_collection.replace_one(
+            {MongoFieldNames.ID_HASH: HASH_SCHEME_METADATA_ID},
+            {
+                MongoFieldNames.ID_HASH: HASH_SCHEME_METADATA_ID,
+                **self.hasher.metadata(),
+                'toplevel_partitions': self.toplevel_partitions,
+                'directory_bucket_digits': self.directory_bucket_digits,
+            },
+            upsert=True,
+        )
+
     def _get_atom_type_hash(self, atom_type):
-        # TODO: implement a proper mongo collection to atom types so instead
-        #      of this lazy hashmap, we should load the hashmap during prefetch
-        named_type_hash = self.named_type_hash.get(atom_type, None)
-        if named_type_hash is None:
-            named_type_hash = ExpressionHasher.named_type_hash(atom_type)
-            self.named_type_hash[atom_type] = named_type_hash
-            self.named_type_hash_reverse[named_type_hash] = atom_type
-        return named_type_hash
+        return self.named_type_registry.named_type_hash(atom_type)
 
     def _retrieve_mongo_document(self, handle: str, arity=-1) -> dict:
-        mongo_filter = {"_id": handle}
+        mongo_filter = {"_id": self.handle_codec.encode(handle)}
         if arity >= 0:
             if arity == 0:
                 return self.mongo_nodes_collection.find_one(mongo_filter)
@@ -270,13 +493,119 @@ class RedisMongoDB(AtomDB):
                 return document
         return None
 
+    def _directory_key(self, key: Union[str, bytes]) -> Union[str, bytes]:
+        digits = self.directory_bucket_digits
+        if isinstance(key, bytes):
+            size, odd = divmod(digits, 2)
+            # The high half of the next byte is the last digit
+            bucket = key[:size] + bytes([key[size] & 0xF0]) if odd else key[:size]
+        else:
+            bucket = key[:digits]
+        return _build_redis_key(KeyPrefix.ATOM_DIRECTORY, bucket)
+
+    @staticmethod
+    def _directory_value(kind: AtomKind, named_type_hash: str) -> bytes:
+        return bytes([kind]) + bytes.fromhex(named_type_hash)
+
+    def _get_directory_entry(self, handle: str) -> Optional[Tuple[AtomKind, str]]:
+        """Kind and named type hash of the atom, if the directory has it."""
+        key = self.handle_codec.encode(handle)
+        value = self.redis.hget(self._directory_key(key), key)
+        if not isinstance(value, bytes) or len(value) < 2:
+            return None
+        return AtomKind(value[0]), value[1:].hex()
+
+    def _retrieve_atom_document(self, handle: str) -> Tuple[Optional[Dict[str, Any]], bool]:
+        """
+        The document of a node or link and whether it's a node. Atoms in the
+        directory are read from their collection with a single query.
+        """
+        entry = self._get_directory_entry(handle)
+        if entry is not None:
+            kind, _ = entry
+            return self._retrieve_mongo_document(handle, kind.bucket_arity), kind == AtomKind.NODE
+        document = self.node_documents.get(self.handle_codec.encode(handle), None)
+        if document is not None:
+            return document, True
+        return self._retrieve_mongo_document(handle), False
+
+    def _get_atom_type(self, handle: str) -> str:
+        entry = self._get_directory_entry(handle)
+        if entry is not None:
+            named_type = self.named_type_registry.named_type(entry[1])
+            if named_type is not None:
+                return named_type
+        return self.get_atom(handle)["named_type"]
+
     def _retrieve_key_value(self, prefix: str, key: str) -> List[str]:
-        members = self.redis.smembers(_build_redis_key(prefix, key))
+        members = self.redis.smembers(_build_redis_key(prefix, self.handle_codec.encode(key)))
         if prefix in self.use_targets:
-            return [pickle.loads(t) for t in members]
+            return self._decode_matches(members)
         else:
             return [*members]
 
+    def _retrieve_key_value_page(
+        self, prefix: str, key: str, cursor: int, page_size: int
+    ) -> Tuple[int, List[Any]]:
+        # SSCAN cursors stay valid while the set changes; COUNT is only a hint
+        next_cursor, members = self.redis.sscan(
+            _build_redis_key(prefix, self.handle_codec.encode(key)), cursor, count=page_size
+        )
+        if prefix in self.use_targets:
+            return next_cursor, self._decode_matches(members)
+        return next_cursor, [*members]
+
+    def _retrieve_matches(
+        self, prefix: str, key: str, extra_parameters: Optional[Dict[str, Any]]
+    ) -> Union[list, Tuple[int, list]]:
+        page_request = self._page_request(extra_parameters)
+        toplevel_only = bool(extra_parameters and extra_parameters.get("toplevel_only"))
+        if toplevel_only and self.toplevel_partitions:
+            prefix = TOPLEVEL_PREFIXES[prefix]
+        if page_request is None:
+            matches = self._retrieve_key_value(prefix, key)
+        else:
+            next_cursor, matches = self._retrieve_key_value_page(prefix, key, *page_request)
+        if len(matches) > 0 and toplevel_only and not self.toplevel_partitions:
+            matches = self._filter_non_toplevel(matches)
+        return matches if page_request is None else (next_cursor, matches)
+
+    def _encode_match(self, handle: Any, targets: List[Any]) -> bytes:
+        """Member of the pattern and template sets for a link (encoded handles)."""
+        if not self.legacy_members:
+            try:
+                return encode_member(handle, targets)
+            except ValueError:  # handles which aren't digests stay pickled
+                pass
+        return self._pickle_match(handle, targets)
+
+    @staticmethod
+    def _pickle_match(handle: Any, targets: List[Any]) -> bytes:
+        return pickle.dumps((handle, tuple(targets)))
+
+    def _decode_matches(self, members: Iterable[bytes]) -> List[Any]:
+        return [
+            (
+                decode_member(member)
+                if member[0] == MEMBER_VERSION
+                else self._decode_match(pickle.loads(member))
+            )
+            for member in members
+        ]
+
+    def _decode_member(self, member: bytes) -> str:
+        if self.handle_codec.compact:
+            return self.handle_codec.decode(member)
+        return member.decode()
+
+    def _decode_match(self, match: Any) -> Any:
+        if not self.handle_codec.compact:
+            return match
+        if isinstance(match, list):
+            return [self._decode_match(item) for item in match]
+        handle, targets = match
+        return (self.handle_codec.decode(handle), tuple(self.handle_codec.decode_list(targets)))
+
     def _build_named_type_hash_template(self, template: Union[str, List[Any]]) -> List[Any]:
         if isinstance(template, str):
             return self._get_atom_type_hash(template)
@@ -289,8 +618,7 @@ class RedisMongoDB(AtomDB):
 
     def _build_named_type_template(self, template: Union[str, List[Any]]) -> List[Any]:
         if isinstance(template, str):
-            ret = self.named_type_hash_reverse.get(template, None)
-            return ret
+            return self.named_type_registry.named_type(template)
         else:
             answer = []
             for element in template:
@@ -312,22 +640,40 @@ class RedisMongoDB(AtomDB):
                 answer.append(key)
             index += 1
 
+    def _link_collection(self, arity: int):
+        if arity == 1:
+            return self.mongo_link_collection["1"]
+        if arity == 2:
+            return self.mongo_link_collection["2"]
+        return self.mongo_link_collection["N"]
+
     def _filter_non_toplevel(self, matches: list) -> list:
         if isinstance(matches[0], list):
             matches = matches[0]
-        matches_toplevel_only = []
+        # Links are checked with one query per arity collection and batch instead
+        # of one query per match
+        matches_by_collection = {}
         for match in matches:
-            link_handle = match[0]
-            link = self._retrieve_mongo_document(link_handle, len(match[-1]))
-            if link['is_toplevel']:
-                matches_toplevel_only.append(match)
-        return matches_toplevel_only
+            collection = self._link_collection(len(match[-1]))
+            matches_by_collection.setdefault(id(collection), (collection, []))[1].append(match)
+        toplevel = set()
+        for collection, collection_matches in matches_by_collection.values():
+            for start in range(0, len(collection_matches), TOPLEVEL_FILTER_BATCH_SIZE):
+                end = start + TOPLEVEL_FILTER_BATCH_SIZE
+                handles = [
+                    self.handle_codec.encode(match[0]) for match in collection_matches[start:end]
+                ]
+                documents = collection.find(
+                    {"_id": {"$in": handles}, "is_toplevel": True}, projection={"_id": 1}
+                )
+                toplevel.update(document["_id"] for document in documents)
+        return [match for match in matches if self.handle_codec.encode(match[0]) in toplevel]
 
     def get_node_handle(self, node_type: str, node_name: str) -> str:
         node_handle = self.node_handle(node_type, node_name)
         document = self._retrieve_mongo_document(node_handle, 0)
         if document is not None:
-            return document["_id"]
+            return self.handle_codec.decode(document["_id"])
         else:
             raise NodeDoesNotExist(
                 message="This node does not exist",
@@ -341,42 +687,125 @@ class RedisMongoDB(AtomDB):
         return answer[0].decode()
 
     def get_node_type(self, node_handle: str) -> str:
-        document = self.get_atom(node_handle)
-        return document["named_type"]
+        return self._get_atom_type(node_handle)
+
+    def _search_node_names(
+        self, node_type_hash: str, term: str, match: str
+    ) -> Optional[Iterator[str]]:
+        """Matches read from the RediSearch index, or None if it can't answer the query."""
+        if node_type_hash is None:
+            return iter([])
+        query = f'@type:{{{node_type_hash}}}'
+        if term:
+            escaped_term = _escape_search_term(term)
+            if match == 'token':
+                query += f' @name_tokens:({escaped_term})'
+            elif len(term) < NAME_SEARCH_MIN_TERM_SIZE:
+                return None
+            elif match == 'prefix':
+                query += f' @name:{{{escaped_term}*}}'
+            else:
+                query += f' @name:{{*{escaped_term}*}}'
+        try:
+            response = self.redis.execute_command(
+                'FT.AGGREGATE',
+                NAME_SEARCH_INDEX,
+                query,
+                'LOAD',
+                '1',
+                '@__key',
+                'WITHCURSOR',
+                'COUNT',
+                NAME_SEARCH_BATCH_SIZE,
+                'DIALECT',
+                '2',
+            )
+        except ResponseError as exception:
+            logger().warning(f'Redis name search failed, using Mongo: {exception}')
+            return None
+        return self._read_name_search_cursor(response)
 
-    def get_matched_node_name(self, node_type: str, substring: str) -> str:
+    def _read_name_search_cursor(self, response: list) -> Iterator[str]:
+        prefix_size = len(KeyPrefix.NAME_SEARCH.value) + 1
+        while True:
+            rows, cursor_id = response
+            for row in rows[1:]:
+                handle = row[1][prefix_size:]
+                if isinstance(handle, bytes) and not self.handle_codec.compact:
+                    handle = handle.decode()
+                yield self.handle_codec.decode(handle)
+            if not cursor_id:
+                break
+            response = self.redis.execute_command('FT.CURSOR', 'READ', NAME_SEARCH_INDEX, cursor_id)
+
+    def get_matched_node_name(
+        self,
+        node_type: str,
+        substring: str,
+        extra_parameters: Optional[Dict[str, Any]] = None,
+    ) -> Iterator[str]:
+        """
+        extra_parameters['match'] may be 'substring' (default), 'prefix' or 'token'.
+        With redis_name_search the query is answered by the RediSearch index and
+        falls back to a regex on Mongo when the index can't answer it. Either way
+        substrings and prefixes are case sensitive, and tokens (the words of the
+        name) aren't.
+        """
+        match = (extra_parameters or {}).get('match', 'substring')
+        if match not in NAME_MATCH_MODES:
+            raise InvalidOperationException(
+                message='Invalid name match mode',
+                details=f'match: {match}',
+            )
         node_type_hash = self._get_atom_type_hash(node_type)
+        if self.redis_name_search:
+            handles = self._search_node_names(node_type_hash, substring, match)
+            if handles is not None:
+                return handles
+        name_filter = {'$regex': re.escape(substring)}
+        if match == 'prefix':
+            name_filter['$regex'] = '^' + name_filter['$regex']
+        elif match == 'token':
+            # Like the RediSearch text field
+            name_filter['$regex'] = r'(^|\W)' + name_filter['$regex'] + r'($|\W)'
+            name_filter['$options'] = 'i'
         mongo_filter = {
             MongoFieldNames.TYPE: node_type_hash,
-            MongoFieldNames.NODE_NAME: {'$regex': substring},
+            MongoFieldNames.NODE_NAME: name_filter,
         }
-        return [
-            document[MongoFieldNames.ID_HASH]
-            for document in self.mongo_nodes_collection.find(mongo_filter)
-        ]
+        documents = self.mongo_nodes_collection.find(
+            mongo_filter, projection={MongoFieldNames.ID_HASH: 1}
+        )
+        return (
+            self.handle_codec.decode(document[MongoFieldNames.ID_HASH]) for document in documents
+        )
 
-    def get_all_nodes(self, node_type: str, names: bool = False) -> List[str]:
+    def get_all_nodes(self, node_type: str, names: bool = False) -> Iterator[str]:
         node_type_hash = self._get_atom_type_hash(node_type)
         if node_type_hash is None:
             raise ValueError(f'Invalid node type: {node_type}')
+        # Filtered and projected by the server (see _setup_indexes)
+        mongo_filter = {MongoFieldNames.TYPE: node_type_hash}
         if names:
-            return [
-                document[MongoFieldNames.NODE_NAME]
-                for document in self.node_documents.values()
-                if document[MongoFieldNames.TYPE] == node_type_hash
-            ]
+            documents = self.mongo_nodes_collection.find(
+                mongo_filter,
+                projection={MongoFieldNames.NODE_NAME: 1, MongoFieldNames.ID_HASH: 0},
+            )
+            return (document[MongoFieldNames.NODE_NAME] for document in documents)
         else:
-            return [
-                document[MongoFieldNames.ID_HASH]
-                for document in self.node_documents.values()
-                if document[MongoFieldNames.TYPE] == node_type_hash
-            ]
+            documents = self.mongo_nodes_collection.find(
+                mongo_filter, projection={MongoFieldNames.ID_HASH: 1}
+            )
+            return (
+                self.handle_codec.decode(document[MongoFieldNames.ID_HASH])
+                for document in documents
+            )
 
     def get_link_handle(self, link_type: str, target_handles: List[str]) -> str:
         link_handle = self.link_handle(link_type, target_handles)
         document = self._retrieve_mongo_document(link_handle, len(target_handles))
         if document is not None:
-            return document["_id"]
+            return self.handle_codec.decode(document["_id"])
         else:
             raise LinkDoesNotExist(
                 message="This link does not exist",
@@ -384,12 +813,23 @@ class RedisMongoDB(AtomDB):
             )
 
     def get_link_targets(self, link_handle: str) -> List[str]:
-        answer = self._retrieve_key_value(KeyPrefix.OUTGOING_SET, link_handle)
+        key = _build_redis_key(KeyPrefix.OUTGOING_SET, self.handle_codec.encode(link_handle))
+        try:
+            answer = [self._decode_member(h) for h in self.redis.lrange(key, 0, -1)]
+        except ResponseError:
+            # A set written by earlier loaders, which loses the order and repeated
+            # targets. The link document has them.
+            document = self._retrieve_mongo_document(link_handle)
+            keys = [] if document is None else self._get_mongo_document_keys(document)
+            answer = self.handle_codec.decode_list(keys)
         if not answer:
             raise ValueError(f"Invalid handle: {link_handle}")
-        return [h.decode() for h in answer]
+        return answer
 
     def is_ordered(self, link_handle: str) -> bool:
+        entry = self._get_directory_entry(link_handle)
+        if entry is not None and entry[0] != AtomKind.NODE:
+            return True
         document = self._retrieve_mongo_document(link_handle)
         if document is None:
             raise ValueError(f"Invalid handle: {link_handle}")
@@ -405,9 +845,10 @@ class RedisMongoDB(AtomDB):
             try:
                 link_handle = self.get_link_handle(link_type, target_handles)
                 document = self._retrieve_mongo_document(link_handle, len(target_handles))
-                return [link_handle] if document else []
+                matches = [link_handle] if document else []
             except ValueError:
-                return []
+                matches = []
+            return matches if self._page_request(extra_parameters) is None else (0, matches)
 
         if link_type == WILDCARD:
             link_type_hash = WILDCARD
@@ -415,20 +856,14 @@ class RedisMongoDB(AtomDB):
             link_type_hash = self._get_atom_type_hash(link_type)
 
         if link_type_hash is None:
-            return []
+            return [] if self._page_request(extra_parameters) is None else (0, [])
 
         if link_type in UNORDERED_LINK_TYPES:
             target_handles = sorted(target_handles)
 
-        pattern_hash = ExpressionHasher.composite_hash([link_type_hash, *target_handles])
-
-        patterns_matched = self._retrieve_key_value(KeyPrefix.PATTERNS, pattern_hash)
-
-        if len(patterns_matched) > 0:
-            if extra_parameters and extra_parameters.get("toplevel_only"):
-                return self._filter_non_toplevel(patterns_matched)
+        pattern_hash = self.hasher.composite_hash([link_type_hash, *target_handles])
 
-        return patterns_matched
+        return self._retrieve_matches(KeyPrefix.PATTERNS, pattern_hash, extra_parameters)
 
     def get_matched_type_template(
         self,
@@ -437,12 +872,8 @@ class RedisMongoDB(AtomDB):
     ) -> List[str]:
         try:
             template = self._build_named_type_hash_template(template)
-            template_hash = ExpressionHasher.composite_hash(template)
-            templates_matched = self._retrieve_key_value(KeyPrefix.TEMPLATES, template_hash)
-            if len(templates_matched) > 0:
-                if extra_parameters and extra_parameters.get("toplevel_only"):
-                    return self._filter_non_toplevel(templates_matched)
-            return templates_matched
+            template_hash = self.hasher.composite_hash(template)
+            return self._retrieve_matches(KeyPrefix.TEMPLATES, template_hash, extra_parameters)
         except Exception as exception:
             raise ValueError(str(exception))
 
@@ -450,22 +881,15 @@ class RedisMongoDB(AtomDB):
         self, link_type: str, extra_parameters: Optional[Dict[str, Any]] = None
     ) -> List[str]:
         named_type_hash = self._get_atom_type_hash(link_type)
-        templates_matched = self._retrieve_key_value(KeyPrefix.TEMPLATES, named_type_hash)
-        if len(templates_matched) > 0:
-            if extra_parameters and extra_parameters.get("toplevel_only"):
-                return self._filter_non_toplevel(templates_matched)
-        return templates_matched
+        return self._retrieve_matches(KeyPrefix.TEMPLATES, named_type_hash, extra_parameters)
 
     def get_link_type(self, link_handle: str) -> str:
-        document = self.get_atom(link_handle)
-        return document["named_type"]
+        return self._get_atom_type(link_handle)
 
     def get_atom(self, handle: str) -> Dict[str, Any]:
-        document = self.node_documents.get(handle, None)
-        if document is None:
-            document = self._retrieve_mongo_document(handle)
+        document, _ = self._retrieve_atom_document(handle)
         if document:
-            atom = self._convert_atom_format(document)
+            atom = self._convert_atom_format(self.handle_codec.decode_document(document))
             return atom
         else:
             raise AtomDoesNotExist(
@@ -475,20 +899,27 @@ class RedisMongoDB(AtomDB):
 
     def get_atom_as_dict(self, handle, arity=-1) -> dict:
         answer = {}
-        document = self.node_documents.get(handle, None) if arity <= 0 else None
-        if document is None:
-            document = self._retrieve_mongo_document(handle, arity)
-            if document:
-                answer["handle"] = document[MongoFieldNames.ID_HASH]
-                answer["type"] = document[MongoFieldNames.TYPE_NAME]
-                answer["template"] = self._build_named_type_template(
-                    document[MongoFieldNames.COMPOSITE_TYPE]
-                )
-                answer["targets"] = self._get_mongo_document_keys(document)
+        if arity < 0:
+            document, is_node = self._retrieve_atom_document(handle)
+        elif arity == 0:
+            document, is_node = (
+                self.node_documents.get(self.handle_codec.encode(handle), None),
+                True,
+            )
         else:
-            answer["handle"] = document[MongoFieldNames.ID_HASH]
-            answer["type"] = document[MongoFieldNames.TYPE_NAME]
+            document, is_node = self._retrieve_mongo_document(handle, arity), False
+        if document is None:
+            return answer
+        document = self.handle_codec.decode_document(document)
+        answer["handle"] = document[MongoFieldNames.ID_HASH]
+        answer["type"] = document[MongoFieldNames.TYPE_NAME]
+        if is_node:
             answer["name"] = document[MongoFieldNames.NODE_NAME]
+        else:
+            answer["template"] = self._build_named_type_template(
+                document[MongoFieldNames.COMPOSITE_TYPE]
+            )
+            answer["targets"] = self._get_mongo_document_keys(document)
         return answer
 
     def count_atoms(self) -> Tuple[int, int]:
@@ -511,10 +942,13 @@ class RedisMongoDB(AtomDB):
             self.mongo_db[collection].drop()
 
         self.redis.flushall()
+        self._setup_indexes()
+        if self.redis_name_search:
+            self._setup_name_search()
+        self.toplevel_partitions = True
+        self._write_metadata()
 
     def prefetch(self) -> None:
-        self.named_type_hash = {}
-        self.named_type_hash_reverse = {}
         self.named_types = {}
         self.symbol_hash = {}
         self.parent_type = {}
@@ -532,43 +966,216 @@ class RedisMongoDB(AtomDB):
             type_document = self.mongo_types_collection.find_one(
                 {MongoFieldNames.ID_HASH: composite_type_hash}
             )
-            self.named_type_hash[named_type] = named_type_hash
-            self.named_type_hash_reverse[named_type_hash] = named_type
+            self.named_type_registry.add(named_type, named_type_hash)
             if type_document is not None:
                 self.named_types[named_type] = type_document[MongoFieldNames.TYPE_NAME]
                 self.parent_type[named_type_hash] = type_document[MongoFieldNames.TYPE_NAME_HASH]
             self.symbol_hash[named_type] = hash_id
 
+    def _insert_documents(self, collection, documents: List[Dict[str, Any]]) -> None:
+        try:
+            collection.insert_many(documents, ordered=False)
+        except BulkWriteError as exception:
+            toplevel = []
+            for error in exception.details["writeErrors"]:
+                if error["code"] != 11000:  # duplicate insertion error
+                    raise exception
+                document = documents[error["index"]]
+                if document.get('is_toplevel') is True:
+                    toplevel.append(document[MongoFieldNames.ID_HASH])
+            # A link added again as toplevel is toplevel, as in the Redis partitions
+            if toplevel:
+                collection.update_many(
+                    {MongoFieldNames.ID_HASH: {'$in': toplevel}, 'is_toplevel': False},
+                    {'$set': {'is_toplevel': True}},
+                )
+
+    def _index_documents(self, key: str, documents: List[Dict[str, Any]]) -> None:
+        if key == MongoCollectionNames.NODES:
+            self._update_node_index(documents)
+        elif key == MongoCollectionNames.ATOM_TYPES:
+            raise InvalidOperationException
+        else:
+            self._update_link_index(documents)
+
+    def _pools(self) -> Tuple[ThreadPoolExecutor, ThreadPoolExecutor]:
+        if self._commit_pool is None:
+            self._commit_pool = ThreadPoolExecutor(self.commit_workers, 'das-commit')
+            self._index_pool = ThreadPoolExecutor(self.commit_workers, 'das-index')
+        return self._commit_pool, self._index_pool
+
+    def _write_documents(self, key: str, collection, documents: List[Dict[str, Any]]) -> None:
+        if self.commit_workers <= 1 or len(documents) <= COMMIT_CHUNK_SIZE:
+            self._insert_documents(collection, documents)
+            self._index_documents(key, documents)
+            return
+        # Each chunk is indexed once it's stored, while the next one is inserted
+        _, index_pool = self._pools()
+        indexing = None
+        for start in range(0, len(documents), COMMIT_CHUNK_SIZE):
+            end = start + COMMIT_CHUNK_SIZE
+            chunk = documents[start:end]
+            self._insert_documents(collection, chunk)
+            if indexing is not None:
+                indexing.result()
+            indexing = index_pool.submit(self._index_documents, key, chunk)
+        indexing.result()
+
+    def _write_buffer(self, key: str, collection, buffer: set, size: int) -> None:
+        start = time.perf_counter()
+        self._write_documents(key, collection, [d.base for d in buffer])
+        if self.commit_latency:
+            self._adapt_batch_bytes(key, size, time.perf_counter() - start)
+
+    def _adapt_batch_bytes(self, key: str, size: int, elapsed: float) -> None:
+        """
+        Sizes the next buffers of the collection so that writing one takes about
+        commit_latency seconds at the rate of the last write (size bytes in elapsed
+        seconds). The budget changes at most twofold per write.
+        """
+        if size < MIN_BULK_INSERTION_BYTES or elapsed <= 0:
+            return
+        budget = self._batch_bytes.get(key, self.mongo_bulk_insertion_bytes)
+        target = min(max(size / elapsed * self.commit_latency, budget / 2), budget * 2)
+        target = min(max(target, MIN_BULK_INSERTION_BYTES), self.mongo_bulk_insertion_bytes)
+        self._batch_bytes[key] = int(target)
+
+    def _buffer_document(self, key: str, document: Dict[str, Any]) -> bool:
+        """
+        Adds the document to the buffer of the collection, unless it's larger than
+        Mongo allows, and writes the buffer when it's full.
+        """
+        size = _document_size(document)
+        if 4 * size > self.max_mongo_db_document_size:
+            # Strings may take up to 4 bytes per character: only an encoding is exact
+            size = len(bson.encode(document))
+            if size > self.max_mongo_db_document_size:
+                return False
+        _, buffer = self.mongo_bulk_insertion_buffer[key]
+        buffer.add(_HashableDocument(document))
+        self._buffer_bytes[key] += size
+        budget = self._batch_bytes.get(key, self.mongo_bulk_insertion_bytes)
+        if len(buffer) >= self.mongo_bulk_insertion_limit or self._buffer_bytes[key] >= budget:
+            self._buffer_full(key)
+        return True
+
+    def _flush_loop(self) -> None:
+        while True:
+            item = self._flush_queue.get()
+            if item is None:  # stopped by close()
+                self._flush_queue.task_done()
+                return
+            key, collection, buffer, size = item
+            try:
+                self._write_buffer(key, collection, buffer, size)
+            except Exception as exception:  # raised by the caller's next flush
+                with self._flush_lock:
+                    self._failed_buffers.append((key, buffer, size))
+                    if self._flush_error is None:
+                        self._flush_error = exception
+            finally:
+                self._flush_queue.task_done()
+
+    def _raise_flush_error(self) -> None:
+        with self._flush_lock:
+            error, self._flush_error = self._flush_error, None
+            failed, self._failed_buffers = self._failed_buffers, []
+        # Like commit() keeps the buffers it fails to write
+        for key, buffer, size in failed:
+            _, current = self.mongo_bulk_insertion_buffer[key]
+            current.update(buffer)
+            self._buffer_bytes[key] += size
+        if error is not None:
+            raise error
+
+    def _hand_over(self, key: str) -> None:
+        """Swaps the buffer for an empty one and queues it for the background writer."""
+        self._raise_flush_error()
+        collection, buffer = self.mongo_bulk_insertion_buffer[key]
+        self.mongo_bulk_insertion_buffer[key] = (collection, set())
+        size, self._buffer_bytes[key] = self._buffer_bytes[key], 0
+        while len(self._flush_workers) < max(self.commit_workers, 1):
+            worker = threading.Thread(target=self._flush_loop, name='das-flush', daemon=True)
+            worker.start()
+            self._flush_workers.append(worker)
+        # Blocks while the queue is full
+        self._flush_queue.put((key, collection, buffer, size))
+
+    def _buffer_full(self, key: str) -> None:
+        if self.async_flush:
+            self._hand_over(key)
+        else:
+            self.commit()
+
+    def flush(self) -> None:
+        """
+        Waits until the buffers handed to the background writer (async_flush) are
+        written, and raises the first error writing them, if any.
+        """
+        if self._flush_workers:
+            self._flush_queue.join()
+        self._raise_flush_error()
+
+    def close(self) -> None:
+        """
+        Commits the buffered atoms and stops the background writers (async_flush)
+        and the commit_workers pools. Adding atoms afterwards starts them again.
+        """
+        try:
+            self.commit()
+        finally:
+            workers, self._flush_workers = self._flush_workers, []
+            for _ in workers:
+                self._flush_queue.put(None)
+            for worker in workers:
+                worker.join()
+            if self._commit_pool is not None:
+                self._commit_pool.shutdown()
+                self._index_pool.shutdown()
+                self._commit_pool = self._index_pool = None
+
+    def _commit_parallel(self, buffers: List[Tuple[str, Any, set, int]]) -> None:
+        commit_pool, _ = self._pools()
+        writes = [
+            (key, buffer, commit_pool.submit(self._write_buffer, key, collection, buffer, size))
+            for key, collection, buffer, size in buffers
+        ]
+        errors = []
+        for key, buffer, write in writes:
+            error = write.exception()
+            if error is None:
+                buffer.clear()
+                self._buffer_bytes[key] = 0
+            else:
+                errors.append(error)
+        if errors:
+            raise errors[0]
+
     def commit(self) -> None:
-        for key, (
-            collection,
-            buffer,
-        ) in self.mongo_bulk_insertion_buffer.items():
-            if buffer:
-                documents = [d.base for d in buffer]
-                try:
-                    collection.insert_many(documents, ordered=False)
-                except BulkWriteError as exception:
-                    for error in exception.details["writeErrors"]:
-                        if error["code"] != 11000:  # duplicate insertion error
-                            raise exception
-                if key == MongoCollectionNames.NODES:
-                    self._update_node_index(documents)
-                elif key == MongoCollectionNames.ATOM_TYPES:
-                    raise InvalidOperationException
-                else:
-                    self._update_link_index(documents)
+        buffers = [
+            (key, collection, buffer, self._buffer_bytes[key])
+            for key, (collection, buffer) in self.mongo_bulk_insertion_buffer.items()
+            if buffer
+        ]
+        if self.async_flush:
+            for key, _, _, _ in buffers:
+                self._hand_over(key)
+        elif self.commit_workers > 1 and len(buffers) > 1:
+            self._commit_parallel(buffers)
+        else:
+            for key, collection, buffer, size in buffers:
+                self._write_buffer(key, collection, buffer, size)
+                buffer.clear()
+                self._buffer_bytes[key] = 0
+        self.flush()
 
     def add_node(self, node_params: Dict[str, Any]) -> Dict[str, Any]:
         handle, node = self._add_node(node_params)
-        if sys.getsizeof(node['name']) < self.max_mongo_db_document_size:
-            _, buffer = self.mongo_bulk_insertion_buffer[MongoCollectionNames.NODES]
-            buffer.add(_HashableDocument(node))
-            if len(buffer) >= self.mongo_bulk_insertion_limit:
-                self.commit()
+        document = self.handle_codec.encode_document(node)
+        if self._buffer_document(MongoCollectionNames.NODES, document):
             return node
         else:
-            logger().warn("Discarding atom whose name is too large: {node_name}")
+            logger().warning(f"Discarding node whose document is too large: {handle}")
 
     def add_link(self, link_params: Dict[str, Any], toplevel: bool = True) -> Dict[str, Any]:
         handle, link, targets = self._add_link(link_params, toplevel)
@@ -579,19 +1186,242 @@ class RedisMongoDB(AtomDB):
             collection_name = MongoCollectionNames.LINKS_ARITY_2
         else:
             collection_name = MongoCollectionNames.LINKS_ARITY_N
-        _, buffer = self.mongo_bulk_insertion_buffer[collection_name]
-        buffer.add(_HashableDocument(link))
-        if len(buffer) >= self.mongo_bulk_insertion_limit:
-            self.commit()
-        return link
+        document = self.handle_codec.encode_document(link)
+        if self._buffer_document(collection_name, document):
+            return link
+        else:
+            logger().warning(f"Discarding link whose document is too large: {handle}")
+
+    def delete_atom(self, handle: str, recursive: bool = False) -> None:
+        # Pending atoms are written first so they're deleted like the others
+        self.commit()
+        document, is_node = self._retrieve_atom_document(handle)
+        if document is None:
+            raise AtomDoesNotExist(
+                message='This atom does not exist',
+                details=f'handle: {handle}',
+            )
+        # Redis commands go through pipelines of REDIS_PIPELINE_SIZE, as when indexing.
+        # Reads aren't affected by the pending ones: links are deleted from Mongo
+        # right away, and a link found again in an incoming set is skipped.
+        pipeline = self.redis.pipeline(transaction=False)
+        self._delete_atom(handle, document, is_node, recursive, pipeline)
+        pipeline.execute()
+
+    def _delete_atom(
+        self,
+        handle: str,
+        document: Dict[str, Any],
+        is_node: bool,
+        recursive: bool,
+        pipeline: Any,
+    ) -> None:
+        key = self.handle_codec.encode(handle)
+        incoming_key = _build_redis_key(KeyPrefix.INCOMING_SET, key)
+        incoming = self.redis.smembers(incoming_key)
+        if incoming:
+            if not recursive:
+                raise InvalidOperationException(
+                    message='This atom is a target of other links',
+                    details=f'handle: {handle}',
+                )
+            links = self._retrieve_link_documents([self._decode_member(m) for m in incoming])
+            for link_handle, link_document in links.items():
+                self._delete_atom(link_handle, link_document, False, recursive, pipeline)
+            pipeline.delete(incoming_key)
+        if is_node:
+            self._delete_node(key, pipeline)
+        else:
+            self._delete_link(key, document, pipeline)
+        pipeline.hdel(self._directory_key(key), key)
+        if len(pipeline) >= REDIS_PIPELINE_SIZE:
+            pipeline.execute()
+
+    def _retrieve_link_documents(self, handles: List[str]) -> Dict[str, Dict[str, Any]]:
+        """Documents of the links (that still exist) by handle, one query per collection."""
+        remaining = {self.handle_codec.encode(handle): handle for handle in handles}
+        answer = {}
+        for collection in self.mongo_link_collection.values():
+            if not remaining:
+                break
+            mongo_filter = {MongoFieldNames.ID_HASH: {'$in': list(remaining)}}
+            for document in collection.find(mongo_filter):
+                answer[remaining.pop(document[MongoFieldNames.ID_HASH])] = document
+        return answer
+
+    def _delete_node(self, key: Union[str, bytes], pipeline: Any) -> None:
+        self.mongo_nodes_collection.delete_one({MongoFieldNames.ID_HASH: key})
+        self.node_documents.add(-1)
+        pipeline.delete(_build_redis_key(KeyPrefix.NAMED_ENTITIES, key))
+        if self.redis_name_search:
+            pipeline.delete(_build_redis_key(KeyPrefix.NAME_SEARCH, key))
+
+    def _delete_link(self, key: Union[str, bytes], document: Dict[str, Any], pipeline: Any) -> None:
+        # The keys of the link are computed again, as when it was indexed
+        targets = self._get_mongo_document_keys(document)
+        self._link_collection(len(targets)).delete_one({MongoFieldNames.ID_HASH: key})
+        pipeline.delete(_build_redis_key(KeyPrefix.OUTGOING_SET, key))
+        for target in set(targets):
+            pipeline.srem(_build_redis_key(KeyPrefix.INCOMING_SET, target), key)
+        # The link may have been indexed before migrate_members(), pickled
+        members = {self._encode_match(key, targets), self._pickle_match(key, targets)}
+        encode = self.handle_codec.encode
+        named_type_hash = document[MongoFieldNames.TYPE_NAME_HASH]
+        # Removed from the toplevel partitions whatever the document says, as any
+        # commit of the link as toplevel added it to them
+        templates = [KeyPrefix.TEMPLATES, KeyPrefix.TOPLEVEL_TEMPLATES]
+        patterns = [KeyPrefix.PATTERNS, KeyPrefix.TOPLEVEL_PATTERNS]
+        for template_key in [document[MongoFieldNames.TYPE], named_type_hash]:
+            for prefix in templates:
+                pipeline.srem(_build_redis_key(prefix, encode(template_key)), *members)
+        target_handles = self.handle_codec.decode_list(targets)
+        for pattern_key in iter_pattern_keys([named_type_hash, *target_handles], self.hasher):
+            for prefix in patterns:
+                pipeline.srem(_build_redis_key(prefix, encode(pattern_key)), *members)
+
+    def migrate_members(self) -> int:
+        """
+        Rewrites the pickled members of the pattern and template sets, written before
+        the binary members, in the binary encoding. Both are read, so the database
+        can be used meanwhile. Members which aren't a pickled (handle, targets) pair
+        of digests or hex strings are left as they are. Returns the number of
+        members rewritten.
+        """
+        migrated = 0
+        pipeline = self.redis.pipeline(transaction=False)
+        pending = 0
+        for prefix in self.use_targets:
+            keys = _build_redis_key(prefix, '*')
+            for key in self.redis.scan_iter(match=keys, count=REDIS_PIPELINE_SIZE):
+                for member in self.redis.sscan_iter(key, count=REDIS_PIPELINE_SIZE):
+                    if member[0] == MEMBER_VERSION:
+                        continue
+                    match = self._legacy_match(member)
+                    if match is None:
+                        continue
+                    try:
+                        encoded = encode_member(*match)
+                    except ValueError:
+                        continue
+                    pipeline.sadd(key, encoded)
+                    pipeline.srem(key, member)
+                    migrated += 1
+                    pending += 2
+                    if pending >= REDIS_PIPELINE_SIZE:
+                        pipeline.execute()
+                        pending = 0
+        if pending:
+            pipeline.execute()
+        return migrated
+
+    @staticmethod
+    def _legacy_match(member: bytes) -> Optional[Tuple[Any, Tuple[Any, ...]]]:
+        """The (handle, targets) pickled in the member, if it holds one (tuple or list)."""
+        try:
+            match = pickle.loads(member)
+        except Exception:  # not pickled
+            return None
+        if not isinstance(match, (tuple, list)) or len(match) != 2:
+            return None
+        handle, targets = match
+        if not isinstance(handle, (str, bytes)) or not isinstance(targets, (tuple, list)):
+            return None
+        return handle, tuple(targets)
 
     def _update_node_index(self, documents: Iterable[Dict[str, any]]) -> None:
+        """
+        Writes the Redis indexes of the committed nodes (directory entries, names,
+        and the RediSearch hashes with redis_name_search) through pipelines of
+        REDIS_PIPELINE_SIZE commands, like _update_link_index().
+        """
+        self.node_documents.add(len(documents))
+        directory = defaultdict(dict)
+        pipeline = self.redis.pipeline(transaction=False)
+        pending = 0
         for document in documents:
             handle = document["_id"]
             node_name = document["name"]
-            self.node_documents.add()
-            key = _build_redis_key(KeyPrefix.NAMED_ENTITIES, handle)
-            self.redis.sadd(key, node_name)
+            node_type = document[MongoFieldNames.TYPE]
+            directory[self._directory_key(handle)][handle] = self._directory_value(
+                AtomKind.NODE, node_type
+            )
+            pipeline.sadd(_build_redis_key(KeyPrefix.NAMED_ENTITIES, handle), node_name)
+            pending += 1
+            if self.redis_name_search:
+                key = _build_redis_key(KeyPrefix.NAME_SEARCH, handle)
+                pipeline.hset(key, mapping={'name': node_name, 'type': node_type})
+                pending += 1
+            if pending >= REDIS_PIPELINE_SIZE:
+                pipeline.execute()
+                pending = 0
+        for directory_key, entries in directory.items():
+            pipeline.hset(directory_key, mapping=entries)
+            pending += 1
+            if pending >= REDIS_PIPELINE_SIZE:
+                pipeline.execute()
+                pending = 0
+        if pending:
+            pipeline.execute()
 
     def _update_link_index(self, documents: Iterable[Dict[str, any]]) -> None:
-        pass
+        """
+        Writes the Redis indexes of the committed links (directory entries,
+        outgoing lists and incoming sets, templates and patterns, and the toplevel
+        partitions of templates and patterns). Members are grouped
+        by key first, so a key shared by many links of the batch (the template of
+        a type, a pattern with wildcards) gets a single SADD, and the commands go
+        through pipelines of REDIS_PIPELINE_SIZE.
+        """
+        encode = self.handle_codec.encode
+        directory = defaultdict(dict)
+        outgoing = {}
+        members = defaultdict(list)
+        for document in documents:
+            key = document[MongoFieldNames.ID_HASH]
+            targets = self._get_mongo_document_keys(document)
+            named_type_hash = document[MongoFieldNames.TYPE_NAME_HASH]
+            directory[self._directory_key(key)][key] = self._directory_value(
+                AtomKind.of_arity(len(targets)), named_type_hash
+            )
+            # A list keeps the order and repeats of the targets
+            outgoing[_build_redis_key(KeyPrefix.OUTGOING_SET, key)] = targets
+            for target in targets:
+                members[_build_redis_key(KeyPrefix.INCOMING_SET, target)].append(key)
+            member = self._encode_match(key, targets)
+            templates = [KeyPrefix.TEMPLATES]
+            patterns = [KeyPrefix.PATTERNS]
+            if document.get('is_toplevel', True):
+                templates.append(KeyPrefix.TOPLEVEL_TEMPLATES)
+                patterns.append(KeyPrefix.TOPLEVEL_PATTERNS)
+            for template_key in [document[MongoFieldNames.TYPE], named_type_hash]:
+                for prefix in templates:
+                    members[_build_redis_key(prefix, encode(template_key))].append(member)
+            target_handles = self.handle_codec.decode_list(targets)
+            for pattern_key in iter_pattern_keys([named_type_hash, *target_handles], self.hasher):
+                for prefix in patterns:
+                    members[_build_redis_key(prefix, encode(pattern_key))].append(member)
+
+        pipeline = self.redis.pipeline(transaction=False)
+        pending = 0
+        for directory_key, entries in directory.items():
+            pipeline.hset(directory_key, mapping=entries)
+            pending += 1
+            if pending >= REDIS_PIPELINE_SIZE:
+                pipeline.execute()
+                pending = 0
+        for key, targets in outgoing.items():
+            # Links committed again are written once
+            pipeline.delete(key)
+            pipeline.rpush(key, *targets)
+            pending += 2
+            if pending >= REDIS_PIPELINE_SIZE:
+                pipeline.execute()
+                pending = 0
+        for key, key_members in members.items():
+            pipeline.sadd(key, *key_members)
+            pending += 1
+            if pending >= REDIS_PIPELINE_SIZE:
+                pipeline.execute()
+                pending = 0
+        if pending:
+            pipeline.execute()
@@ -1,21 +1,30 @@
 import re
 from abc import ABC, abstractmethod
-from typing import Any, Dict, List
+from typing import Any, Dict, Iterable, Iterator, List, Optional, Tuple
 
 from hyperon_das_atomdb.exceptions import (
     AddLinkException,
     AddNodeException,
+    InvalidHashScheme,
     LinkDoesNotExist,
     NodeDoesNotExist,
 )
-from hyperon_das_atomdb.utils.expression_hasher import ExpressionHasher
+from hyperon_das_atomdb.utils.expression_hasher import DEFAULT_HASH_SCHEME, ExpressionHasher
+from hyperon_das_atomdb.utils.postings import check_page_size
 
 WILDCARD = '*'
 UNORDERED_LINK_TYPES = []
 
+# Paginated queries: passing extra_parameters={'cursor': 0} makes get_matched_links,
+# get_matched_type and get_matched_type_template return (next_cursor, page) instead of
+# every match. next_cursor is passed back to read the next page and is 0 after the
+# last one. 'page_size' is a hint, pages may be shorter (or, on Redis, longer).
+DEFAULT_PAGE_SIZE = 1000
+
 
 class AtomDB(ABC):
     key_pattern = re.compile(r"key_\d+")
+    hasher = ExpressionHasher
 
     def __repr__(self) -> str:
         """
@@ -24,14 +33,78 @@ class AtomDB(ABC):
         """
         return "<Atom database abstract class>"  # pragma no cover
 
-    @staticmethod
-    def node_handle(node_type: str, node_name: str) -> str:
-        return ExpressionHasher.terminal_hash(node_type, node_name)
+    def node_handle(self, node_type: str, node_name: str) -> str:
+        return self.hasher.terminal_hash(node_type, node_name)
+
+    def link_handle(self, link_type: str, target_handles: List[str]) -> str:
+        named_type_hash = self.hasher.named_types.named_type_hash(link_type)
+        return self.hasher.expression_hash(named_type_hash, target_handles)
+
+    def node_handles(self, nodes: Iterable[Tuple[str, str]]) -> List[str]:
+        """
+        Compute the handles of several nodes in a single call.
+
+        Args:
+            nodes (Iterable[Tuple[str, str]]): (node_type, node_name) pairs.
 
-    @staticmethod
-    def link_handle(link_type: str, target_handles: List[str]) -> str:
-        named_type_hash = ExpressionHasher.named_type_hash(link_type)
-        return ExpressionHasher.expression_hash(named_type_hash, target_handles)
+        Returns:
+            List[str]: The node handles, in the same order as the input.
+        """
+        return self.hasher.terminal_hashes(nodes)
+
+    def link_handles(self, links: Iterable[Tuple[str, List[str]]]) -> List[str]:
+        """
+        Compute the handles of several links in a single call.
+
+        Args:
+            links (Iterable[Tuple[str, List[str]]]): (link_type, target_handles) pairs.
+
+        Returns:
+            List[str]: The link handles, in the same order as the input.
+        """
+        type_hash = self.hasher.named_types.named_type_hash
+        return self.hasher.expression_hashes(
+            (type_hash(link_type), target_handles) for link_type, target_handles in links
+        )
+
+    def _check_hash_scheme(self, metadata: Dict[str, Any]) -> None:
+        """
+        Refuse to operate on data hashed with a scheme other than this database's.
+
+        Args:
+            metadata (Dict[str, Any]): Metadata stored along with the data. Data
+                without metadata predates hash schemes and is MD5.
+
+        Raises:
+            InvalidHashScheme: If the schemes differ.
+        """
+        stored = (
+            metadata.get('hash_scheme', DEFAULT_HASH_SCHEME),
+            metadata.get('hash_scheme_version', self.hasher.hash_scheme_version),
+        )
+        current = (self.hasher.hash_scheme, self.hasher.hash_scheme_version)
+        if stored != current:
+            raise InvalidHashScheme(
+                message='Mixing hash schemes is not allowed',
+                details=f'stored: {stored[0]} v{stored[1]}, requested: {current[0]} v{current[1]}',
+            )
+
+    def _page_request(
+        self, extra_parameters: Optional[Dict[str, Any]]
+    ) -> Optional[Tuple[int, int]]:
+        """
+        Returns (cursor, page_size) for paginated queries, None otherwise.
+
+        Raises:
+            InvalidOperationException: If page_size isn't a positive int.
+        """
+        if not extra_parameters or extra_parameters.get('cursor') is None:
+            return None
+        page_size = extra_parameters.get('page_size')
+        return (
+            int(extra_parameters['cursor']),
+            DEFAULT_PAGE_SIZE if page_size is None else check_page_size(page_size),
+        )
 
     def _convert_atom_format(self, document: Dict[str, Any]) -> Dict[str, Any]:
         answer = {'handle': document['_id']}
@@ -77,7 +150,7 @@ class AtomDB(ABC):
         handle = self.node_handle(node_type, node_name)
         node = {
             '_id': handle,
-            'composite_type_hash': ExpressionHasher.named_type_hash(node_type),
+            'composite_type_hash': self.hasher.named_types.named_type_hash(node_type),
             'name': node_name,
             'named_type': node_type,
         }
@@ -113,7 +186,8 @@ class AtomDB(ABC):
                 details=link_params,
             )
 
-        link_type_hash = ExpressionHasher.named_type_hash(link_type)
+        named_types = self.hasher.named_types
+        link_type_hash = named_types.named_type_hash(link_type)
 
         targets_hash = []
         composite_type = [link_type_hash]
@@ -121,7 +195,7 @@ class AtomDB(ABC):
         for target in targets:
             if 'targets' not in target.keys():
                 atom = self.add_node(target)
-                atom_hash = ExpressionHasher.named_type_hash(atom['named_type'])
+                atom_hash = named_types.named_type_hash(atom['named_type'])
                 composite_type.append(atom_hash)
             else:
                 atom = self.add_link(target, toplevel=False)
@@ -129,12 +203,12 @@ class AtomDB(ABC):
                 atom_hash = atom['composite_type_hash']
             composite_type_hash.append(atom_hash)
             targets_hash.append(atom['_id'])
-        handle = ExpressionHasher.expression_hash(link_type_hash, targets_hash)
+        handle = self.hasher.expression_hash(link_type_hash, targets_hash)
 
         arity = len(targets)
         link = {
             '_id': handle,
-            'composite_type_hash': ExpressionHasher.composite_hash(composite_type_hash),
+            'composite_type_hash': named_types.composite_type_hash(composite_type_hash),
             'is_toplevel': toplevel,
             'composite_type': composite_type,
             'named_type': link_type,
@@ -224,21 +298,21 @@ class AtomDB(ABC):
         ...  # pragma no cover
 
     @abstractmethod
-    def get_matched_node_name(self, node_type: str, substring: str) -> str:
+    def get_matched_node_name(self, node_type: str, substring: str) -> Iterator[str]:
         """
-        Get the name of a node of the specified type containing the given substring.
+        Get the handles of the nodes of the specified type whose name contains the given substring.
 
         Args:
             node_type (str): The node type.
             substring (str): The substring to search for in node names.
 
         Returns:
-            str: The name of the matching node.
+            Iterator[str]: An iterator over the handles of the matching nodes.
         """
         ...  # pragma no cover
 
     @abstractmethod
-    def get_all_nodes(self, node_type: str, names: bool = False) -> List[str]:
+    def get_all_nodes(self, node_type: str, names: bool = False) -> Iterator[str]:
         """
         Get all nodes of a specific type.
 
@@ -247,7 +321,8 @@ class AtomDB(ABC):
             names (bool, optional): If True, return node names instead of handles. Default is False.
 
         Returns:
-            List[str]: A list of node handles or names, depending on the value of 'names'.
+            Iterator[str]: An iterator over the node handles or names, depending on the value
+            of 'names'.
         """
         ...  # pragma no cover
 
@@ -315,6 +390,7 @@ class AtomDB(ABC):
 
         Returns:
             [return-type]: The return type description (not specified in the code).
+            With a 'cursor' in extra_parameters, a (next_cursor, page) tuple.
         """
         ...  # pragma no cover
 
@@ -328,6 +404,7 @@ class AtomDB(ABC):
 
         Returns:
             List[str]: A list of identifiers of nodes matching the template.
+            With a 'cursor' in extra_parameters, a (next_cursor, page) tuple.
         """
         ...  # pragma no cover
 
@@ -341,6 +418,7 @@ class AtomDB(ABC):
 
         Returns:
             [return-type]: The return type description (not specified in the code).
+            With a 'cursor' in extra_parameters, a (next_cursor, page) tuple.
         """
         ...  # pragma no cover
 
@@ -491,6 +569,23 @@ class AtomDB(ABC):
         """
         ...  # pragma no cover
 
+    @abstractmethod
+    def delete_atom(self, handle: str, recursive: bool = False) -> None:
+        """
+        Delete an atom from the database, updating only the index keys of that atom.
+
+        Args:
+            handle (str): The atom handle.
+            recursive (bool): Also delete the links having the atom as target (and
+                the links having those as target, and so on). Default is False.
+
+        Raises:
+            AtomDoesNotExist: If there's no atom with this handle.
+            InvalidOperationException: If the atom is a target of other links and
+                recursive is False.
+        """
+        ...  # pragma no cover
+
     @abstractmethod
     def get_atom(self, handle: str) -> Dict[str, Any]:
         ...  # pragma no cover
@@ -1,12 +1,114 @@
-from dataclasses import dataclass
-from typing import Any, Dict, List, Tuple
+from array import array
+from dataclasses import dataclass, field
+from enum import IntEnum
+from typing import Any, Dict, Iterable, Iterator, List, Optional, Tuple
+
+# Typecode of the integer arrays holding atom ids
+ATOM_ID_TYPECODE = 'q'
+
+
+def id_array(atom_ids: Iterable[int] = ()) -> array:
+    return array(ATOM_ID_TYPECODE, atom_ids)
+
+
+@dataclass
+class HandleTable:
+    """
+    Interns handles into dense integer ids, assigned in insertion order.
+    Every handle is kept once (in `handles`) and the indexes refer to atoms by id.
+    """
+
+    ids: Dict[Any, int] = field(default_factory=dict)
+    handles: List[Any] = field(default_factory=list)
+
+    def intern(self, handle: Any) -> int:
+        atom_id = self.ids.get(handle)
+        if atom_id is None:
+            atom_id = len(self.handles)
+            self.ids[handle] = atom_id
+            self.handles.append(handle)
+        return atom_id
+
+    def get(self, handle: Any) -> Optional[int]:
+        return self.ids.get(handle)
+
+    def handle(self, atom_id: int) -> Any:
+        return self.handles[atom_id]
+
+    def __len__(self) -> int:
+        return len(self.handles)
+
+
+class AtomKind(IntEnum):
+    """Whether an atom is a node or, for links, its arity bucket."""
+
+    NODE = 1
+    LINK_ARITY_1 = 2
+    LINK_ARITY_2 = 3
+    LINK_ARITY_N = 4
+
+    @classmethod
+    def of_arity(cls, arity: int) -> 'AtomKind':
+        if arity <= 0:
+            return cls.NODE
+        if arity == 1:
+            return cls.LINK_ARITY_1
+        if arity == 2:
+            return cls.LINK_ARITY_2
+        return cls.LINK_ARITY_N
+
+    @property
+    def bucket_arity(self) -> int:
+        """An arity of the bucket (0 for nodes), as taken by Link.get_table."""
+        return self.value - 1
+
+
+class AtomDirectory:
+    """
+    Kind and type id of every atom, by atom id, so an atom is routed to its
+    table (and its type is known) without probing the tables.
+    """
+
+    def __init__(self) -> None:
+        self.kinds = bytearray()
+        self.type_ids = array('i')
+        self.types: List[str] = []
+        self._type_ids: Dict[str, int] = {}
+
+    def add(self, atom_id: int, kind: AtomKind, named_type: str) -> None:
+        type_id = self._type_ids.get(named_type)
+        if type_id is None:
+            type_id = len(self.types)
+            self.types.append(named_type)
+            self._type_ids[named_type] = type_id
+        if atom_id >= len(self.kinds):
+            missing = atom_id + 1 - len(self.kinds)
+            self.kinds.extend(bytes(missing))
+            self.type_ids.extend(array('i', (0,)) * missing)
+        self.kinds[atom_id] = kind
+        self.type_ids[atom_id] = type_id
+
+    def remove(self, atom_id: int) -> None:
+        self.kinds[atom_id] = 0
+
+    def kind(self, atom_id: Any) -> Optional[AtomKind]:
+        if not isinstance(atom_id, int) or not 0 <= atom_id < len(self.kinds):
+            return None
+        kind = self.kinds[atom_id]
+        return AtomKind(kind) if kind else None
+
+    def named_type(self, atom_id: int) -> str:
+        return self.types[self.type_ids[atom_id]]
+
+    def __len__(self) -> int:
+        return len(self.kinds) - self.kinds.count(0)
 
 
 @dataclass
 class Link:
-    arity_1: Dict[str, Any]
-    arity_2: Dict[str, Any]
-    arity_n: Dict[str, Any]
+    arity_1: Dict[Any, Any]
+    arity_2: Dict[Any, Any]
+    arity_n: Dict[Any, Any]
 
     def get_table(self, arity: int):
         if arity == 1:
@@ -16,16 +118,343 @@ class Link:
         if arity > 2:
             return self.arity_n
 
-    def all_tables(self) -> List[Dict[str, Any]]:
+    def all_tables(self) -> List[Dict[Any, Any]]:
         return [self.arity_1, self.arity_2, self.arity_n]
 
+    def add(self, link_id: int, document: Dict[str, Any], target_ids: List[int]) -> None:
+        self.get_table(len(target_ids))[link_id] = document
+
+    def get_field(self, arity: int, link_id: int, name: str) -> Any:
+        return self.get_table(arity)[link_id][name]
+
+    def remove(self, link_id: int, arity: int) -> None:
+        del self.get_table(arity)[link_id]
+
+
+# Fields every link document has, besides its key_<n> targets
+LINK_FIELDS = (
+    '_id',
+    'composite_type_hash',
+    'is_toplevel',
+    'composite_type',
+    'named_type',
+    'named_type_hash',
+)
+
+
+def _copy_composite_type(composite_type: Any) -> Any:
+    if isinstance(composite_type, list):
+        return [_copy_composite_type(element) for element in composite_type]
+    return composite_type
+
+
+class LinkColumns:
+    """
+    The links of one arity bucket stored as a struct of arrays, one row per link
+    with its id, type id, toplevel bit and target ids. Links of variable arity
+    (arity_n) keep their targets in a flat column, with a (start, end) pair of
+    offsets per row. Targets of removed rows are left as garbage in the column
+    until they outnumber the live ones, when the column is compacted.
+
+    It's read like the dict tables of Link (get, in, len, items) but documents
+    are rebuilt on demand.
+    """
+
+    def __init__(self, store: 'ColumnarLink', bucket: int, arity: Optional[int]) -> None:
+        self.store = store
+        self.bucket = bucket
+        self.arity = arity
+        self.link_ids = id_array()
+        self.type_ids = array('i')
+        self.toplevel = bytearray()
+        self.targets = id_array()
+        self.offsets = id_array()
+        self.garbage = 0
+
+    def __len__(self) -> int:
+        return len(self.link_ids)
+
+    def __contains__(self, link_id: Any) -> bool:
+        return self.store.row(self.bucket, link_id) is not None
+
+    def __iter__(self) -> Iterator[int]:
+        return iter(self.link_ids)
+
+    def __getitem__(self, link_id: int) -> Dict[str, Any]:
+        document = self.get(link_id)
+        if document is None:
+            raise KeyError(link_id)
+        return document
+
+    def get(self, link_id: Any, default: Any = None) -> Any:
+        row = self.store.row(self.bucket, link_id)
+        if row is None:
+            return default
+        return self.store.build_document(self, row)
+
+    def keys(self) -> Iterator[int]:
+        return iter(self.link_ids)
+
+    def values(self) -> Iterator[Dict[str, Any]]:
+        return (self.store.build_document(self, row) for row in range(len(self)))
+
+    def items(self) -> Iterator[Tuple[int, Dict[str, Any]]]:
+        return (
+            (link_id, self.store.build_document(self, row))
+            for row, link_id in enumerate(self.link_ids)
+        )
+
+    def row_targets(self, row: int) -> array:
+        if self.arity is None:
+            start, end = self.offsets[2 * row], self.offsets[2 * row + 1]
+        else:
+            start, end = row * self.arity, (row + 1) * self.arity
+        return self.targets[start:end]
+
+    def remove_row(self, row: int) -> List[Tuple[int, int]]:
+        """
+        Removes a row, moving the last row into it. Returns the (link id, row)
+        of the moved row, if any.
+        """
+        last = len(self.link_ids) - 1
+        if row != last:
+            self.link_ids[row] = self.link_ids[last]
+            self.type_ids[row] = self.type_ids[last]
+            self.toplevel[row] = self.toplevel[last]
+        del self.link_ids[last]
+        del self.type_ids[last]
+        del self.toplevel[last]
+        if self.arity is not None:
+            if row != last:
+                start, end = row * self.arity, (row + 1) * self.arity
+                self.targets[start:end] = self.row_targets(last)
+            start = last * self.arity
+            del self.targets[start:]
+        else:
+            # Only the offsets move; the targets of the row are garbage
+            start, end = self.offsets[2 * row], self.offsets[2 * row + 1]
+            self.garbage += end - start
+            if row != last:
+                self.offsets[2 * row] = self.offsets[2 * last]
+                self.offsets[2 * row + 1] = self.offsets[2 * last + 1]
+            del self.offsets[-2:]
+            if self.garbage > len(self.targets) // 2:
+                self.compact()
+        return [] if row == last else [(self.link_ids[row], row)]
+
+    def compacted(self) -> Tuple[array, array]:
+        """The targets and offsets columns without the garbage, in row order."""
+        if not self.garbage:
+            return self.targets, self.offsets
+        targets = id_array()
+        offsets = id_array()
+        for row in range(len(self.link_ids)):
+            offsets.append(len(targets))
+            targets.extend(self.row_targets(row))
+            offsets.append(len(targets))
+        return targets, offsets
+
+    def compact(self) -> None:
+        self.targets, self.offsets = self.compacted()
+        self.garbage = 0
+
+    def append(self, link_id: int, type_id: int, toplevel: bool, target_ids: List[int]) -> int:
+        row = len(self.link_ids)
+        self.link_ids.append(link_id)
+        self.type_ids.append(type_id)
+        self.toplevel.append(1 if toplevel else 0)
+        if self.arity is None:
+            self.offsets.append(len(self.targets))
+        self.targets.extend(target_ids)
+        if self.arity is None:
+            self.offsets.append(len(self.targets))
+        return row
+
+
+class LinkTargets:
+    """Read-only view of the target ids of a ColumnarLink, standing for outgoing_set."""
+
+    def __init__(self, store: 'ColumnarLink') -> None:
+        self.store = store
+
+    def __len__(self) -> int:
+        return sum(len(table) for table in self.store.all_tables())
+
+    def __contains__(self, link_id: Any) -> bool:
+        return self.store.targets(link_id) is not None
+
+    def __getitem__(self, link_id: int) -> array:
+        targets = self.store.targets(link_id)
+        if targets is None:
+            raise KeyError(link_id)
+        return targets
+
+    def get(self, link_id: Any, default: Any = None) -> Any:
+        targets = self.store.targets(link_id)
+        return default if targets is None else targets
+
+    def items(self) -> Iterator[Tuple[int, array]]:
+        for table in self.store.all_tables():
+            for row, link_id in enumerate(table.link_ids):
+                yield link_id, table.row_targets(row)
+
+
+class ColumnarLink:
+    """
+    Columnar alternative to Link. The type fields of a link (named_type,
+    named_type_hash, composite_type, composite_type_hash) are kept once per
+    distinct composite type and referenced by a type id, and custom attributes
+    go to a side table.
+    """
+
+    def __init__(self, handles: HandleTable) -> None:
+        self.handles = handles
+        self.types: List[Tuple[str, str, List[Any], str]] = []
+        self.type_ids: Dict[str, int] = {}
+        self.attributes: Dict[int, Dict[str, Any]] = {}
+        # Bucket (1, 2 or 3 for arity_n; 0 for atoms which aren't links) and row, by atom id
+        self.buckets = bytearray()
+        self.rows = id_array()
+        self.arity_1 = LinkColumns(self, 1, 1)
+        self.arity_2 = LinkColumns(self, 2, 2)
+        self.arity_n = LinkColumns(self, 3, None)
+
+    def get_table(self, arity: int) -> LinkColumns:
+        if arity == 1:
+            return self.arity_1
+        if arity == 2:
+            return self.arity_2
+        if arity > 2:
+            return self.arity_n
+
+    def all_tables(self) -> List[LinkColumns]:
+        return [self.arity_1, self.arity_2, self.arity_n]
+
+    def row(self, bucket: int, link_id: Any) -> Optional[int]:
+        if not isinstance(link_id, int) or not 0 <= link_id < len(self.buckets):
+            return None
+        if self.buckets[link_id] != bucket:
+            return None
+        return self.rows[link_id]
+
+    def _locate(self, link_id: Any) -> Tuple[Optional[LinkColumns], Optional[int]]:
+        if not isinstance(link_id, int) or not 0 <= link_id < len(self.buckets):
+            return None, None
+        bucket = self.buckets[link_id]
+        if bucket == 0:
+            return None, None
+        return self.all_tables()[bucket - 1], self.rows[link_id]
+
+    def targets(self, link_id: Any) -> Optional[array]:
+        table, row = self._locate(link_id)
+        return None if table is None else table.row_targets(row)
+
+    def outgoing_set(self) -> LinkTargets:
+        return LinkTargets(self)
+
+    def _intern_type(self, document: Dict[str, Any]) -> int:
+        composite_type_hash = document['composite_type_hash']
+        type_id = self.type_ids.get(composite_type_hash)
+        if type_id is None:
+            type_id = len(self.types)
+            self.types.append(
+                (
+                    document['named_type'],
+                    document['named_type_hash'],
+                    _copy_composite_type(document['composite_type']),
+                    composite_type_hash,
+                )
+            )
+            self.type_ids[composite_type_hash] = type_id
+        return type_id
+
+    def add(self, link_id: int, document: Dict[str, Any], target_ids: List[int]) -> None:
+        table = self.get_table(len(target_ids))
+        type_id = self._intern_type(document)
+        reserved = set(LINK_FIELDS).union(f'key_{position}' for position in range(len(target_ids)))
+        attributes = {key: value for key, value in document.items() if key not in reserved}
+        row = self.row(table.bucket, link_id)
+        if row is None:
+            if link_id >= len(self.buckets):
+                missing = link_id + 1 - len(self.buckets)
+                self.buckets.extend(bytes(missing))
+                self.rows.extend(id_array((0,)) * missing)
+            self.buckets[link_id] = table.bucket
+            self.rows[link_id] = table.append(link_id, type_id, document['is_toplevel'], target_ids)
+        else:
+            table.type_ids[row] = type_id
+            table.toplevel[row] = 1 if document['is_toplevel'] else 0
+        if attributes:
+            self.attributes[link_id] = attributes
+        else:
+            self.attributes.pop(link_id, None)
+
+    def remove(self, link_id: int, arity: int) -> None:
+        table = self.get_table(arity)
+        row = self.row(table.bucket, link_id)
+        if row is None:
+            raise KeyError(link_id)
+        self.buckets[link_id] = 0
+        self.attributes.pop(link_id, None)
+        for moved_link_id, moved_row in table.remove_row(row):
+            self.rows[moved_link_id] = moved_row
+
+    def get_field(self, arity: int, link_id: int, name: str) -> Any:
+        table = self.get_table(arity)
+        row = self.row(table.bucket, link_id)
+        if row is None:
+            raise KeyError(link_id)
+        if name == 'is_toplevel':
+            return bool(table.toplevel[row])
+        named_type, named_type_hash, composite_type, composite_type_hash = self.types[
+            table.type_ids[row]
+        ]
+        if name == 'named_type':
+            return named_type
+        if name == 'named_type_hash':
+            return named_type_hash
+        if name == 'composite_type_hash':
+            return composite_type_hash
+        if name == 'composite_type':
+            return _copy_composite_type(composite_type)
+        return self.build_document(table, row)[name]
+
+    def build_document(self, table: LinkColumns, row: int) -> Dict[str, Any]:
+        named_type, named_type_hash, composite_type, composite_type_hash = self.types[
+            table.type_ids[row]
+        ]
+        link_id = table.link_ids[row]
+        handles = self.handles.handles
+        document = {
+            '_id': handles[link_id],
+            'composite_type_hash': composite_type_hash,
+            'is_toplevel': bool(table.toplevel[row]),
+            'composite_type': _copy_composite_type(composite_type),
+            'named_type': named_type,
+            'named_type_hash': named_type_hash,
+        }
+        for position, target_id in enumerate(table.row_targets(row)):
+            document[f'key_{position}'] = handles[target_id]
+        document.update(self.attributes.get(link_id, {}))
+        return document
+
 
 @dataclass
 class Database:
     atom_type: Dict[str, Any]
-    node: Dict[str, Any]
+    node: Dict[Any, Any]
     link: Link
-    outgoing_set: Dict[str, Any]
-    incomming_set: Dict[str, Any]
-    patterns: Dict[str, List[Tuple]]
-    templates: Dict[str, List[Tuple]]
+    outgoing_set: Dict[Any, Any]
+    incomming_set: Dict[Any, Any]
+    patterns: Dict[Any, Any]
+    templates: Dict[Any, Any]
+    positions: Dict[Tuple, Any] = field(default_factory=dict)
+    # Partitions of patterns and templates with the toplevel links only
+    toplevel_patterns: Dict[Any, Any] = field(default_factory=dict)
+    toplevel_templates: Dict[Any, Any] = field(default_factory=dict)
+    nodes_by_type: Dict[str, Any] = field(default_factory=dict)
+    # TrigramIndex of node names, when enabled
+    node_names: Optional[Any] = None
+    directory: AtomDirectory = field(default_factory=AtomDirectory)
+    metadata: Dict[str, Any] = field(default_factory=dict)
+    handles: HandleTable = field(default_factory=HandleTable)
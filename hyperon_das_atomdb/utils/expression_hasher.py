@@ -1,44 +1,206 @@
-from hashlib import md5
-from typing import Any, List
+import sys
+from hashlib import blake2b, md5
+from typing import Any, Callable, Dict, Iterable, List, Optional, Tuple, Type
+
+from hyperon_das_atomdb.exceptions import InvalidHashScheme
+
+DEFAULT_HASH_SCHEME = 'md5'
+
+# Bump when the way a scheme turns expressions into hashed text changes, so
+# databases built with an older layout are refused instead of silently mixed.
+HASH_SCHEME_VERSION = 1
+
+
+def _md5_hexdigest(data: bytes) -> str:
+    return md5(data).hexdigest()
+
+
+def _blake2b_hexdigest(data: bytes) -> str:
+    return blake2b(data, digest_size=16).hexdigest()
+
+
+# All schemes produce 128-bit digests so handles keep the same size (16 bytes,
+# 32 hex chars) whatever the scheme is.
+HASH_SCHEMES: Dict[str, Callable[[bytes], str]] = {
+    'md5': _md5_hexdigest,
+    'blake2b-128': _blake2b_hexdigest,
+}
+
+try:
+    import xxhash
+
+    HASH_SCHEMES['xxh3-128'] = xxhash.xxh3_128_hexdigest
+except ImportError:  # pragma no cover
+    pass
+
+try:
+    from blake3 import blake3
+
+    def _blake3_hexdigest(data: bytes) -> str:
+        return blake3(data).hexdigest(length=16)
+
+    HASH_SCHEMES['blake3-128'] = _blake3_hexdigest
+except ImportError:  # pragma no cover
+    pass
 
 
 class ExpressionHasher:
     compound_separator = " "
+    hash_scheme = DEFAULT_HASH_SCHEME
+    hash_scheme_version = HASH_SCHEME_VERSION
+    _hexdigest = staticmethod(_md5_hexdigest)
+    _scheme_hashers: Dict[str, Type['ExpressionHasher']] = {}
+    # Interned named type hashes of the scheme, see NamedTypeRegistry
+    named_types: 'NamedTypeRegistry'
 
-    @staticmethod
-    def _compute_hash(text: str) -> str:
-        return md5(text.encode("utf-8")).digest().hex()
+    @classmethod
+    def for_scheme(cls, hash_scheme: Optional[str] = None) -> Type['ExpressionHasher']:
+        """
+        Get the hasher for the given hash scheme.
 
-    @staticmethod
-    def named_type_hash(name: str) -> str:
-        return ExpressionHasher._compute_hash(name)
+        ExpressionHasher itself implements the default (MD5) scheme. Other schemes
+        are subclasses which only replace the digest function.
 
-    @staticmethod
-    def terminal_hash(named_type: str, terminal_name: str) -> str:
-        return ExpressionHasher._compute_hash(
-            ExpressionHasher.compound_separator.join([named_type, terminal_name])
-        )
+        Args:
+            hash_scheme (str, optional): One of HASH_SCHEMES. Default is MD5.
 
-    @staticmethod
-    def expression_hash(named_type_hash: str, elements: List[str]) -> str:
-        return ExpressionHasher.composite_hash([named_type_hash, *elements])
+        Returns:
+            Type[ExpressionHasher]: The hasher class for the scheme.
 
-    @staticmethod
-    def composite_hash(hash_base: Any) -> str:
+        Raises:
+            InvalidHashScheme: If the scheme is unknown or its package is not installed.
+        """
+        if hash_scheme is None or hash_scheme == DEFAULT_HASH_SCHEME:
+            return ExpressionHasher
+        hexdigest = HASH_SCHEMES.get(hash_scheme)
+        if hexdigest is None:
+            raise InvalidHashScheme(
+                message='Unknown hash scheme',
+                details=f'{hash_scheme} (available: {sorted(HASH_SCHEMES)})',
+            )
+        hasher = ExpressionHasher._scheme_hashers.get(hash_scheme)
+        if hasher is None:
+            hasher = type(
+                f'ExpressionHasher[{hash_scheme}]',
+                (ExpressionHasher,),
+                {'hash_scheme': hash_scheme, '_hexdigest': staticmethod(hexdigest)},
+            )
+            hasher.named_types = NamedTypeRegistry(hasher)
+            ExpressionHasher._scheme_hashers[hash_scheme] = hasher
+        return hasher
+
+    @classmethod
+    def metadata(cls) -> Dict[str, Any]:
+        return {'hash_scheme': cls.hash_scheme, 'hash_scheme_version': cls.hash_scheme_version}
+
+    @classmethod
+    def _compute_hash(cls, text: str) -> str:
+        return cls._hexdigest(text.encode("utf-8"))
+
+    @classmethod
+    def named_type_hash(cls, name: str) -> str:
+        return cls._compute_hash(name)
+
+    @classmethod
+    def terminal_hash(cls, named_type: str, terminal_name: str) -> str:
+        return cls._compute_hash(cls.compound_separator.join([named_type, terminal_name]))
+
+    @classmethod
+    def expression_hash(cls, named_type_hash: str, elements: List[str]) -> str:
+        return cls.composite_hash([named_type_hash, *elements])
+
+    @classmethod
+    def composite_hash(cls, hash_base: Any) -> str:
         if isinstance(hash_base, str):
             return hash_base
         elif isinstance(hash_base, list):
             if len(hash_base) == 1:
                 return hash_base[0]
             else:
-                return ExpressionHasher._compute_hash(
-                    ExpressionHasher.compound_separator.join(hash_base)
-                )
+                return cls._compute_hash(cls.compound_separator.join(hash_base))
         else:
             raise ValueError(
                 "Invalid base to compute composite hash: " f"{type(hash_base)}: {hash_base}"
             )
 
+    # Batch entry points. They produce exactly the same handles as the methods above
+    # but hash a whole list in a single loop, avoiding per-call Python overhead when
+    # loaders compute millions of handles.
+
+    @classmethod
+    def named_type_hashes(cls, names: Iterable[str]) -> List[str]:
+        hexdigest = cls._hexdigest
+        return [hexdigest(name.encode("utf-8")) for name in names]
+
+    @classmethod
+    def terminal_hashes(cls, terminals: Iterable[Tuple[str, str]]) -> List[str]:
+        hexdigest = cls._hexdigest
+        separator = cls.compound_separator
+        return [
+            hexdigest(f"{named_type}{separator}{terminal_name}".encode("utf-8"))
+            for named_type, terminal_name in terminals
+        ]
+
+    @classmethod
+    def expression_hashes(cls, expressions: Iterable[Tuple[str, List[str]]]) -> List[str]:
+        hexdigest = cls._hexdigest
+        join = cls.compound_separator.join
+        return [
+            hexdigest(join([named_type_hash, *elements]).encode("utf-8"))
+            if elements
+            else named_type_hash
+            for named_type_hash, elements in expressions
+        ]
+
+    @classmethod
+    def composite_hashes(cls, hash_bases: Iterable[List[str]]) -> List[str]:
+        return [cls.composite_hash(hash_base) for hash_base in hash_bases]
+
+
+class NamedTypeRegistry:
+    """
+    Interned named type hashes of a hash scheme, shared by every database using
+    that scheme. Type names repeat in almost every atom so their hashes (and the
+    hashes of composite types) are computed once per process, and every document
+    refers to the same string object.
+    """
+
+    def __init__(self, hasher: Type[ExpressionHasher]) -> None:
+        self.hasher = hasher
+        self._hashes: Dict[str, str] = {}
+        self._names: Dict[str, str] = {}
+        self._composite_hashes: Dict[Tuple[str, ...], str] = {}
+        self.typedef_mark_hash = self.named_type_hash(":")
+        self.base_type_hash = self.named_type_hash("Type")
+        self.typedef_composite_type_hash = self.composite_type_hash(
+            [self.typedef_mark_hash, self.base_type_hash, self.base_type_hash]
+        )
+
+    def named_type_hash(self, name: str) -> str:
+        named_type_hash = self._hashes.get(name)
+        if named_type_hash is None:
+            named_type_hash = sys.intern(self.hasher.named_type_hash(name))
+            self.add(name, named_type_hash)
+        return named_type_hash
+
+    def add(self, name: str, named_type_hash: str) -> None:
+        self._hashes[name] = named_type_hash
+        self._names[named_type_hash] = name
+
+    def named_type(self, named_type_hash: str) -> Optional[str]:
+        return self._names.get(named_type_hash)
+
+    def composite_type_hash(self, composite_type_hash: List[str]) -> str:
+        key = tuple(composite_type_hash)
+        answer = self._composite_hashes.get(key)
+        if answer is None:
+            answer = sys.intern(self.hasher.composite_hash(composite_type_hash))
+            self._composite_hashes[key] = answer
+        return answer
+
+
+ExpressionHasher.named_types = NamedTypeRegistry(ExpressionHasher)
+
 
 class StringExpressionHasher:
     @staticmethod
@@ -0,0 +1,85 @@
+from typing import Any, Dict, List, Union
+
+from hyperon_das_atomdb.database import AtomDB
+
+HANDLE_SIZE = 16
+
+Handle = Union[str, bytes]
+
+
+class HandleCodec:
+    """
+    Identity codec: handles are stored exactly as they are exposed by the API,
+    i.e. as 32-char hex strings.
+    """
+
+    compact = False
+
+    def encode(self, handle: str) -> Handle:
+        return handle
+
+    def decode(self, handle: Handle) -> str:
+        return handle
+
+    def encode_list(self, handles: List[str]) -> List[Handle]:
+        return handles
+
+    def decode_list(self, handles: List[Handle]) -> List[str]:
+        return handles
+
+    def encode_document(self, document: Dict[str, Any]) -> Dict[str, Any]:
+        return document
+
+    def decode_document(self, document: Dict[str, Any]) -> Dict[str, Any]:
+        return document
+
+
+class CompactHandleCodec(HandleCodec):
+    """
+    Keeps handles as the raw 16-byte digest internally (dict keys, Redis key
+    suffixes, Mongo _id) and converts them to hex only at the API boundary.
+    """
+
+    compact = True
+
+    def encode(self, handle: str) -> Handle:
+        if len(handle) != 2 * HANDLE_SIZE:
+            # Not a valid handle. It's kept as it is so lookups just miss.
+            return handle
+        try:
+            return bytes.fromhex(handle)
+        except ValueError:
+            return handle
+
+    def decode(self, handle: Handle) -> str:
+        if isinstance(handle, bytes):
+            return handle.hex()
+        return handle
+
+    def encode_list(self, handles: List[str]) -> List[Handle]:
+        return [self.encode(handle) for handle in handles]
+
+    def decode_list(self, handles: List[Handle]) -> List[str]:
+        return [self.decode(handle) for handle in handles]
+
+    def encode_document(self, document: Dict[str, Any]) -> Dict[str, Any]:
+        answer = {}
+        for key, value in document.items():
+            if key == '_id' or AtomDB.key_pattern.fullmatch(key):
+                answer[key] = self.encode(value)
+            else:
+                answer[key] = value
+        return answer
+
+    def decode_document(self, document: Dict[str, Any]) -> Dict[str, Any]:
+        answer = {}
+        for key, value in document.items():
+            if key == '_id' or AtomDB.key_pattern.fullmatch(key):
+                answer[key] = self.decode(value)
+            else:
+                answer[key] = value
+        return answer
+
+
+def handle_codec(compact_handles: bool = False) -> HandleCodec:
+    return CompactHandleCodec() if compact_handles else HandleCodec()
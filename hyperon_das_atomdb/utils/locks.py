@@ -0,0 +1,114 @@
+import functools
+import threading
+from contextlib import contextmanager
+from typing import Any, Callable, Iterator
+
+from hyperon_das_atomdb.exceptions import InvalidOperationException
+
+
+class ReadWriteLock:
+    """
+    Many readers or a single writer. Waiting writers go first, so a steady flow of
+    readers can't starve them.
+
+    It's reentrant: a thread holding the lock can take it again to read, and the
+    writer can take it again to write. Taking it to write while holding it to read
+    would deadlock and raises instead.
+    """
+
+    def __init__(self) -> None:
+        self._condition = threading.Condition(threading.Lock())
+        self._readers = 0
+        self._waiting_writers = 0
+        self._writer = None
+        self._writer_depth = 0
+        self._local = threading.local()
+
+    def _read_depth(self) -> int:
+        return getattr(self._local, 'depth', 0)
+
+    @contextmanager
+    def read(self) -> Iterator[None]:
+        if self._writer == threading.get_ident():
+            yield
+            return
+        depth = self._read_depth()
+        if depth == 0:
+            with self._condition:
+                while self._writer is not None or self._waiting_writers:
+                    self._condition.wait()
+                self._readers += 1
+        self._local.depth = depth + 1
+        try:
+            yield
+        finally:
+            self._local.depth = depth
+            if depth == 0:
+                with self._condition:
+                    self._readers -= 1
+                    if self._readers == 0:
+                        self._condition.notify_all()
+
+    @contextmanager
+    def write(self) -> Iterator[None]:
+        me = threading.get_ident()
+        if self._writer == me:
+            self._writer_depth += 1
+            try:
+                yield
+            finally:
+                self._writer_depth -= 1
+            return
+        if self._read_depth():
+            raise InvalidOperationException(
+                message='Writes are not allowed while reading',
+                details='the read lock of this thread must be released first',
+            )
+        with self._condition:
+            self._waiting_writers += 1
+            try:
+                while self._writer is not None or self._readers:
+                    self._condition.wait()
+            finally:
+                self._waiting_writers -= 1
+            self._writer = me
+        try:
+            yield
+        finally:
+            with self._condition:
+                self._writer = None
+                self._condition.notify_all()
+
+
+def read_locked(method: Callable) -> Callable:
+    """
+    Runs the method holding the read lock of the database (self._lock), if it has
+    one. Iterators are consumed while holding it, so they don't see later writes.
+    """
+
+    @functools.wraps(method)
+    def wrapper(self, *args, **kwargs) -> Any:
+        lock = self._lock
+        if lock is None:
+            return method(self, *args, **kwargs)
+        with lock.read():
+            answer = method(self, *args, **kwargs)
+            if isinstance(answer, Iterator):
+                answer = iter(list(answer))
+            return answer
+
+    return wrapper
+
+
+def write_locked(method: Callable) -> Callable:
+    """Runs the method holding the write lock of the database (self._lock), if it has one."""
+
+    @functools.wraps(method)
+    def wrapper(self, *args, **kwargs) -> Any:
+        lock = self._lock
+        if lock is None:
+            return method(self, *args, **kwargs)
+        with lock.write():
+            return method(self, *args, **kwargs)
+
+    return wrapper
@@ -0,0 +1,51 @@
+from functools import lru_cache
+from operator import itemgetter
+from typing import Callable, Tuple, Union
+
+from hyperon_das_atomdb.utils.handles import HANDLE_SIZE
+
+# Members of the Redis pattern and template sets identify a link and its targets.
+#
+# Layout of version 1: the version byte, then the link handle and its targets as
+# HANDLE_SIZE-byte digests. The arity is implied by the length of the member.
+#
+# Members written before were pickled (handle, targets) tuples, which start with the
+# pickle protocol opcode, so the first byte tells them apart.
+MEMBER_VERSION = 1
+_MEMBER_VERSION_BYTE = bytes([MEMBER_VERSION])
+
+# Hex digits of a handle
+_HEX_SIZE = 2 * HANDLE_SIZE
+
+
+def encode_member(handle: Union[str, bytes], targets: Tuple[Union[str, bytes], ...]) -> bytes:
+    """
+    Member of a link with the given handle and targets, either all hex strings or all
+    HANDLE_SIZE-byte digests (compact handles).
+
+    Raises:
+        ValueError: If a handle isn't a HANDLE_SIZE-byte digest.
+    """
+    try:
+        if isinstance(handle, bytes):
+            answer = b''.join([_MEMBER_VERSION_BYTE, handle, *targets])
+        else:
+            answer = _MEMBER_VERSION_BYTE + bytes.fromhex(handle + ''.join(targets))
+    except TypeError as exception:  # hex strings mixed with digests
+        raise ValueError(f'Invalid handles in member: {handle}, {targets}') from exception
+    if len(answer) != 1 + HANDLE_SIZE * (1 + len(targets)):
+        raise ValueError(f'Invalid handles in member: {handle}, {targets}')
+    return answer
+
+
+@lru_cache(maxsize=None)
+def _handles_getter(size: int) -> Callable[[str], Tuple[str, ...]]:
+    """Slices the handles (link and targets) out of the hex of a member of this size."""
+    return itemgetter(*(slice(start, start + _HEX_SIZE) for start in range(2, size, _HEX_SIZE)))
+
+
+def decode_member(member: bytes) -> Tuple[str, Tuple[str, ...]]:
+    """Handle and targets (hex strings) of a member written by encode_member()."""
+    hexed = member.hex()
+    handles = _handles_getter(len(hexed))(hexed)
+    return handles[0], handles[1:]
@@ -0,0 +1,220 @@
+import sys
+from collections import Counter
+from itertools import islice
+from typing import Any, Dict, Tuple
+
+from hyperon_das_atomdb.database import AtomDB
+from hyperon_das_atomdb.entity import AtomKind, Database, LinkColumns, LinkTargets
+from hyperon_das_atomdb.utils.snapshot import (
+    KEYED_INDEXES,
+    MappedHandleTable,
+    MappedIndex,
+    MappedNodes,
+    MappedPostings,
+)
+
+# Entries sampled to estimate the bytes of an index or a table of documents
+DEFAULT_SAMPLE_SIZE = 1000
+
+LINK_TABLES = {
+    AtomKind.LINK_ARITY_1: 'link.arity_1',
+    AtomKind.LINK_ARITY_2: 'link.arity_2',
+    AtomKind.LINK_ARITY_N: 'link.arity_n',
+}
+
+# Document fields referring to objects owned by other structures (interned handles
+# and type hashes) or shared by every document (booleans)
+_SHARED_FIELDS = frozenset(
+    ['_id', 'named_type', 'named_type_hash', 'composite_type_hash', 'is_toplevel']
+)
+
+
+def buffer_bytes(*buffers: Any) -> int:
+    """
+    Bytes of arrays, bytearrays or memoryviews. The size of a memoryview object
+    doesn't include the data it refers to, so it's measured by its nbytes.
+    """
+    return sum(
+        buffer.nbytes if isinstance(buffer, memoryview) else sys.getsizeof(buffer)
+        for buffer in buffers
+    )
+
+
+def index_stats(index: Any, sample_size: int = DEFAULT_SAMPLE_SIZE) -> Dict[str, int]:
+    """
+    Entries, total postings and bytes of a posting index (key -> sorted atom ids).
+    For dict indexes the bytes of a key and the overhead of a posting array (its
+    header and spare capacity) are estimated from sample_size entries, and the
+    atom ids are counted exactly.
+    """
+    if isinstance(index, MappedIndex):
+        buffers = [index.keys_data, index.key_offsets, index.offsets, index.values_data]
+    elif isinstance(index, MappedPostings):
+        buffers = [index.offsets, index.values_data]
+    else:
+        getsizeof = sys.getsizeof
+        entries = len(index)
+        postings = sum(map(len, index.values()))
+        sample = list(islice(index.items(), sample_size))
+        size = getsizeof(index)
+        if sample:
+            itemsize = sample[0][1].itemsize
+            overhead = sum(
+                getsizeof(key) + getsizeof(value) - len(value) * itemsize for key, value in sample
+            )
+            size += round(entries * overhead / len(sample)) + postings * itemsize
+        return {'entries': entries, 'postings': postings, 'bytes': size}
+    return {
+        'entries': len(index),
+        'postings': len(index.values_data),
+        'bytes': buffer_bytes(*buffers),
+    }
+
+
+def document_bytes(document: Dict[str, Any]) -> int:
+    """Bytes of a document and of the values it owns."""
+    answer = sys.getsizeof(document)
+    for key, value in document.items():
+        if key not in _SHARED_FIELDS and not AtomDB.key_pattern.fullmatch(key):
+            answer += sys.getsizeof(value)
+    return answer
+
+
+def table_stats(table: Any, sample_size: int) -> Tuple[Dict[str, int], Dict[str, float]]:
+    """
+    Entries and bytes of a table of atoms (atom id -> document), with the mean
+    bytes of an atom of each type found in the sample. Dict tables are estimated
+    from their first sample_size documents; columnar and mapped tables are
+    measured by their arrays.
+    """
+    entries = len(table)
+    if isinstance(table, LinkColumns):
+        arrays = [table.link_ids, table.type_ids, table.toplevel, table.targets, table.offsets]
+        return {'entries': entries, 'bytes': buffer_bytes(*arrays)}, {}
+    if isinstance(table, MappedNodes):
+        size = buffer_bytes(table.names, table.name_offsets)
+        return {'entries': entries, 'bytes': size}, {}
+    totals: Counter = Counter()
+    counts: Counter = Counter()
+    for document in islice(table.values(), sample_size):
+        totals[document['named_type']] += document_bytes(document)
+        counts[document['named_type']] += 1
+    sampled = sum(counts.values())
+    mean = sum(totals.values()) / sampled if sampled else 0
+    # The hash table and its keys, atom ids about as large (as ints) as entries
+    table_bytes = sys.getsizeof(table) + entries * sys.getsizeof(entries)
+    overhead = table_bytes / entries if entries else 0
+    means = {
+        named_type: totals[named_type] / count + overhead for named_type, count in counts.items()
+    }
+    return {'entries': entries, 'bytes': table_bytes + round(mean * entries)}, means
+
+
+def handles_stats(handles: Any, sample_size: int = DEFAULT_SAMPLE_SIZE) -> Dict[str, int]:
+    """Entries and bytes of a HandleTable. Handles all have the same size, so a sample will do."""
+    entries = len(handles)
+    if isinstance(handles, MappedHandleTable):
+        return {'entries': entries, 'bytes': buffer_bytes(handles.handles.digests, handles.order)}
+    getsizeof = sys.getsizeof
+    size = getsizeof(handles.ids) + getsizeof(handles.handles)
+    sample = handles.handles[:sample_size]
+    if sample:
+        handle_bytes = sum(map(getsizeof, sample)) / len(sample)
+        # Each handle is kept once, along with its id
+        size += round(entries * (handle_bytes + getsizeof(entries)))
+    return {'entries': entries, 'bytes': size}
+
+
+def _object_bytes(value: Any, sample_size: int) -> int:
+    # Matches and match lists, estimated from their first items. The handles in
+    # them are owned by the handle table or the handle cache.
+    size = sys.getsizeof(value)
+    if isinstance(value, (tuple, list)) and value:
+        sample = value[:sample_size]
+        items = sum(
+            _object_bytes(item, sample_size) for item in sample if not isinstance(item, str)
+        )
+        size += round(len(value) * items / len(sample))
+    return size
+
+
+def cache_stats(cache: Dict[Any, Any], sample_size: int = DEFAULT_SAMPLE_SIZE) -> Dict[str, int]:
+    """
+    Entries and bytes of a query cache of InMemoryDB (atom id -> handle or match,
+    or index key -> match list), estimated from sample_size entries. Matches kept
+    by both the match and the result caches are counted in each.
+    """
+    entries = len(cache)
+    size = sys.getsizeof(cache)
+    sample = list(islice(cache.items(), sample_size))
+    if sample:
+        total = sum(sys.getsizeof(key) + _object_bytes(value, sample_size) for key, value in sample)
+        size += round(entries * total / len(sample))
+    return {'entries': entries, 'bytes': size}
+
+
+def memory_stats(
+    db: Database, sample_size: int = DEFAULT_SAMPLE_SIZE, mapped_bytes: int = 0
+) -> Dict[str, Any]:
+    """
+    Entry counts, posting totals and estimated bytes of the structures of an
+    InMemoryDB database, and link counts and bytes by link type. Counts are
+    exact; bytes are estimated from sample_size entries of each structure, so
+    the only full passes are C loops (posting totals and link types).
+
+    Objects shared by several structures (handles, type hashes, the keys shared by
+    an index and its toplevel partition) are counted in each of them, so the
+    total is an upper bound. Structures read from a mapped snapshot report the
+    size of their sections, which are file backed rather than anonymous memory.
+    """
+    indexes: Dict[str, Dict[str, int]] = {}
+    node, _ = table_stats(db.node, sample_size)
+    indexes['node'] = node
+    # Mean bytes of a link of each kind, overall and by the link types sampled
+    link_bytes: Dict[int, Tuple[float, Dict[str, float]]] = {}
+    for kind, name in LINK_TABLES.items():
+        stats, means = table_stats(db.link.get_table(kind.bucket_arity), sample_size)
+        indexes[name] = stats
+        mean = stats['bytes'] / stats['entries'] if stats['entries'] else 0
+        link_bytes[kind] = (mean, means)
+    if isinstance(db.outgoing_set, LinkTargets):
+        # The targets are columns of the link tables
+        postings = sum(len(table.targets) - table.garbage for table in db.link.all_tables())
+        indexes['outgoing_set'] = {
+            'entries': len(db.outgoing_set),
+            'postings': postings,
+            'bytes': 0,
+        }
+    else:
+        indexes['outgoing_set'] = index_stats(db.outgoing_set, sample_size)
+    indexes['incomming_set'] = index_stats(db.incomming_set, sample_size)
+    for name in KEYED_INDEXES:
+        indexes[name] = index_stats(getattr(db, name), sample_size)
+    if db.node_names is not None:
+        partitions = db.node_names.partitions.values()
+        trigrams = [index_stats(partition, sample_size) for partition in partitions]
+        indexes['node_names'] = {
+            key: sum(stats[key] for stats in trigrams) for key in ['entries', 'postings', 'bytes']
+        }
+    indexes['handles'] = handles_stats(db.handles, sample_size)
+    directory = db.directory
+    indexes['directory'] = {
+        'entries': len(directory),
+        'bytes': buffer_bytes(directory.kinds, directory.type_ids),
+    }
+
+    link_types: Dict[str, Dict[str, int]] = {}
+    for (kind, type_id), count in Counter(zip(directory.kinds, directory.type_ids)).items():
+        if kind in (0, AtomKind.NODE):
+            continue
+        named_type = directory.types[type_id]
+        mean, means = link_bytes[kind]
+        stats = link_types.setdefault(named_type, {'links': 0, 'bytes': 0})
+        stats['links'] += count
+        stats['bytes'] += round(count * means.get(named_type, mean))
+    return {
+        'indexes': indexes,
+        'link_types': link_types,
+        'bytes': sum(stats['bytes'] for stats in indexes.values()),
+        'mapped_bytes': mapped_bytes,
+    }
@@ -1,4 +1,4 @@
-from typing import List
+from typing import Iterator, List, Optional, Type
 
 from hyperon_das_atomdb.database import WILDCARD
 from hyperon_das_atomdb.utils.expression_hasher import ExpressionHasher
@@ -31,11 +31,134 @@ def multiply_binary_matrix_by_string_matrix(
     return result_matrix[:-1]
 
 
-def build_patern_keys(hash_list: List[str]) -> List[str]:
-    binary_matrix = generate_binary_matrix(len(hash_list))
-    result_matrix = multiply_binary_matrix_by_string_matrix(binary_matrix, hash_list)
-    keys = [
-        ExpressionHasher.expression_hash(matrix_item[:1][0], matrix_item[1:])
-        for matrix_item in result_matrix
-    ]
-    return keys
+def iter_pattern_keys(
+    hash_list: List[str],
+    hasher: Type[ExpressionHasher] = ExpressionHasher,
+    max_wildcards: Optional[int] = None,
+) -> Iterator[str]:
+    """
+    Yield the pattern keys of an expression, i.e. the hash of every combination of
+    its elements with some of them replaced by WILDCARD (except the one without
+    wildcards).
+
+    Masks are walked depth first so the joined text of a prefix is built once and
+    shared by every mask starting with it, and no intermediate matrix is built.
+    Keys are the same as build_patern_keys() used to return, in a different order.
+
+    Args:
+        hash_list (List[str]): [named_type_hash, *target_handles].
+        hasher (Type[ExpressionHasher], optional): Hasher of the database.
+        max_wildcards (int, optional): Skip combinations with more wildcards.
+
+    Returns:
+        Iterator[str]: The pattern keys.
+    """
+    size = len(hash_list)
+    if size < 2:
+        if size == 1 and max_wildcards != 0:
+            yield hasher.composite_hash([WILDCARD])
+        return
+    last = size - 1
+    compute_hash = hasher._compute_hash
+    separator = hasher.compound_separator
+    limit = size if max_wildcards is None else max_wildcards
+    # (index of the next element, joined text of the elements before it, wildcards used)
+    stack = [(0, '', 0)]
+    push = stack.append
+    pop = stack.pop
+    while stack:
+        index, prefix, wildcards = pop()
+        element = hash_list[index]
+        if index == last:
+            if wildcards:
+                yield compute_hash(prefix + element)
+            if wildcards < limit:
+                yield compute_hash(prefix + WILDCARD)
+        else:
+            push((index + 1, prefix + element + separator, wildcards))
+            if wildcards < limit:
+                push((index + 1, prefix + WILDCARD + separator, wildcards + 1))
+
+
+def build_patern_keys(
+    hash_list: List[str], hasher: Type[ExpressionHasher] = ExpressionHasher
+) -> List[str]:
+    return list(iter_pattern_keys(hash_list, hasher))
+
+
+class PatternIndexStrategy:
+    """
+    Decides which wildcard patterns of a link are written to the patterns index.
+    Patterns which are not written are answered at query time from other indexes.
+    """
+
+    positional = False
+
+    def pattern_keys(
+        self, hash_list: List[str], hasher: Type[ExpressionHasher] = ExpressionHasher
+    ) -> Iterator[str]:
+        """Keys of the patterns index the link is posted to."""
+        raise NotImplementedError  # pragma no cover
+
+    def indexes(self, pattern: List[str]) -> bool:
+        """True if links matching the pattern are all posted to its key."""
+        raise NotImplementedError  # pragma no cover
+
+
+class FullPatternIndex(PatternIndexStrategy):
+    """Every wildcard combination is written: 2^(arity+1)-1 postings per link."""
+
+    def pattern_keys(
+        self, hash_list: List[str], hasher: Type[ExpressionHasher] = ExpressionHasher
+    ) -> Iterator[str]:
+        return iter_pattern_keys(hash_list, hasher)
+
+    def indexes(self, pattern: List[str]) -> bool:
+        return True
+
+    def __repr__(self) -> str:
+        return "FullPatternIndex()"
+
+
+class BoundedPatternIndex(PatternIndexStrategy):
+    """
+    Only combinations with up to max_wildcards wildcards (the link type counts as
+    an element) are written. Queries with more wildcards scan the candidates found
+    through the incoming set of a target or the template of the type.
+    """
+
+    def __init__(self, max_wildcards: int) -> None:
+        if max_wildcards < 0:
+            raise ValueError(f"Invalid max_wildcards: {max_wildcards}")
+        self.max_wildcards = max_wildcards
+
+    def pattern_keys(
+        self, hash_list: List[str], hasher: Type[ExpressionHasher] = ExpressionHasher
+    ) -> Iterator[str]:
+        return iter_pattern_keys(hash_list, hasher, self.max_wildcards)
+
+    def indexes(self, pattern: List[str]) -> bool:
+        return pattern.count(WILDCARD) <= self.max_wildcards
+
+    def __repr__(self) -> str:
+        return f"BoundedPatternIndex({self.max_wildcards})"
+
+
+class PositionalPatternIndex(PatternIndexStrategy):
+    """
+    No wildcard combination is written. Instead the link is posted once per
+    (type, arity, position, target), and queries intersect these postings.
+    """
+
+    positional = True
+
+    def pattern_keys(
+        self, hash_list: List[str], hasher: Type[ExpressionHasher] = ExpressionHasher
+    ) -> Iterator[str]:
+        return iter(())
+
+    def indexes(self, pattern: List[str]) -> bool:
+        return False
+
+    def __repr__(self) -> str:
+        return "PositionalPatternIndex()"
@@ -0,0 +1,126 @@
+from bisect import bisect_left
+from heapq import merge
+from typing import Any, List, MutableSequence, Sequence, Tuple
+
+from hyperon_das_atomdb.exceptions import InvalidOperationException
+
+
+def add_posting(postings: MutableSequence[int], atom_id: int) -> bool:
+    """
+    Adds atom_id to a sorted posting list keeping it sorted and without
+    duplicates. Returns False if it was already there.
+    """
+    if not postings or postings[-1] < atom_id:
+        # Ids are assigned in insertion order so this is the usual case
+        postings.append(atom_id)
+        return True
+    index = bisect_left(postings, atom_id)
+    if index < len(postings) and postings[index] == atom_id:
+        return False
+    postings.insert(index, atom_id)
+    return True
+
+
+def add_postings(postings: MutableSequence[int], atom_ids: Sequence[int]) -> None:
+    """
+    Adds the sorted, deduplicated atom_ids to a sorted posting list at once. They
+    are appended when they all come after it, as when a batch of new atoms is
+    indexed, and merged otherwise.
+    """
+    if not atom_ids:
+        return
+    if not postings or postings[-1] < atom_ids[0]:
+        postings.extend(atom_ids)
+        return
+    merged = union(postings, atom_ids)
+    del postings[:]
+    postings.extend(merged)
+
+
+def remove_posting(postings: MutableSequence[int], atom_id: int) -> bool:
+    """Removes atom_id from a sorted posting list. Returns False if it wasn't there."""
+    index = bisect_left(postings, atom_id)
+    if index < len(postings) and postings[index] == atom_id:
+        del postings[index]
+        return True
+    return False
+
+
+def gallop(postings: Sequence[int], atom_id: int, start: int = 0) -> int:
+    """
+    Index of the first element >= atom_id at or after start. The search probes
+    exponentially growing steps before bisecting, so it's cheap when the answer
+    is close to start.
+    """
+    size = len(postings)
+    bound = 1
+    while start + bound < size and postings[start + bound] < atom_id:
+        bound *= 2
+    return bisect_left(postings, atom_id, start + bound // 2, min(start + bound + 1, size))
+
+
+def intersect(*postings: Sequence[int]) -> List[int]:
+    """
+    Intersection of sorted posting lists. Each id of the shortest list is
+    galloped for in the others, so the cost depends mostly on the shortest one.
+    """
+    if not postings:
+        return []
+    smallest, *others = sorted(postings, key=len)
+    if not others:
+        return list(smallest)
+    cursors = [0] * len(others)
+    answer = []
+    for atom_id in smallest:
+        found = True
+        for index, other in enumerate(others):
+            position = gallop(other, atom_id, cursors[index])
+            if position == len(other):
+                return answer
+            cursors[index] = position
+            if other[position] != atom_id:
+                found = False
+                break
+        if found:
+            answer.append(atom_id)
+    return answer
+
+
+def union(*postings: Sequence[int]) -> List[int]:
+    """Sorted, deduplicated union of sorted posting lists."""
+    postings = [posting for posting in postings if posting]
+    if len(postings) == 1:
+        return list(postings[0])
+    answer = []
+    for atom_id in merge(*postings):
+        if not answer or answer[-1] != atom_id:
+            answer.append(atom_id)
+    return answer
+
+
+def check_page_size(size: Any) -> int:
+    """
+    Raises:
+        InvalidOperationException: If size isn't a positive int.
+    """
+    if isinstance(size, bool) or not isinstance(size, int) or size <= 0:
+        raise InvalidOperationException(message='Invalid page size', details=f'page_size: {size!r}')
+    return size
+
+
+def page(postings: Sequence[int], cursor: int, size: int) -> Tuple[int, Sequence[int]]:
+    """
+    Reads up to size ids from a sorted posting list, starting at the first id
+    not smaller than cursor. Returns the cursor of the next page (0 after the
+    last one) and the ids. Cursors are ids, not offsets, so they stay valid
+    while the list grows or shrinks.
+
+    Raises:
+        InvalidOperationException: If size isn't a positive int.
+    """
+    check_page_size(size)
+    start = bisect_left(postings, cursor)
+    end = start + size
+    ids = postings[start:end]
+    next_cursor = ids[-1] + 1 if end < len(postings) else 0
+    return next_cursor, ids
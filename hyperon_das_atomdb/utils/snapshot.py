@@ -0,0 +1,671 @@
+import json
+import mmap
+import os
+import struct
+import sys
+from array import array
+from typing import Any, Dict, Iterator, List, Optional, Tuple
+
+from hyperon_das_atomdb.entity import (
+    ATOM_ID_TYPECODE,
+    AtomDirectory,
+    AtomKind,
+    ColumnarLink,
+    Database,
+    HandleTable,
+    Link,
+    id_array,
+)
+from hyperon_das_atomdb.exceptions import InvalidOperationException
+from hyperon_das_atomdb.utils.handles import HANDLE_SIZE
+from hyperon_das_atomdb.utils.patterns import (
+    BoundedPatternIndex,
+    FullPatternIndex,
+    PatternIndexStrategy,
+    PositionalPatternIndex,
+)
+
+# Layout of a snapshot file:
+#
+#   magic | version (u32) | padding (u32) | header offset (u64) | header size (u64)
+#   sections, each one aligned to SECTION_ALIGNMENT
+#   header (JSON object with the small tables and the offset of every section)
+#
+# Sections are flat arrays in native byte order which are memory mapped and read
+# in place, so opening a snapshot doesn't parse (nor copy) the atoms and indexes.
+# Nothing is unpickled: the header and keys are data only.
+SNAPSHOT_MAGIC = b'DASSNAP\x00'
+SNAPSHOT_VERSION = 3
+SECTION_ALIGNMENT = 8
+_PREAMBLE = struct.Struct('<8sIIQQ')
+
+# Posting indexes of Database saved as sorted keys (see MappedIndex)
+KEYED_INDEXES = [
+    'patterns',
+    'templates',
+    'toplevel_patterns',
+    'toplevel_templates',
+    'positions',
+    'nodes_by_type',
+]
+
+# Tags of the keys of a MappedIndex: hex handles are saved as their 16-byte digest,
+# other keys (type names, position tuples) as JSON
+_HEX_KEY = b'\x01'
+_BYTES_KEY = b'\x02'
+_OTHER_KEY = b'\x03'
+
+# Pattern index strategies are saved by name and parameters
+_STRATEGIES = {
+    strategy.__name__: strategy
+    for strategy in [FullPatternIndex, BoundedPatternIndex, PositionalPatternIndex]
+}
+
+
+def encode_key(key: Any) -> bytes:
+    if isinstance(key, str) and len(key) == 2 * HANDLE_SIZE:
+        try:
+            digest = bytes.fromhex(key)
+        except ValueError:
+            digest = None
+        if digest is not None and digest.hex() == key:
+            return _HEX_KEY + digest
+    if isinstance(key, bytes):
+        return _BYTES_KEY + key
+    return _OTHER_KEY + json.dumps(key, separators=(',', ':')).encode('utf-8')
+
+
+def decode_key(data: bytes) -> Any:
+    tag, value = data[:1], data[1:]
+    if tag == _HEX_KEY:
+        return value.hex()
+    if tag == _BYTES_KEY:
+        return value
+    key = json.loads(value)
+    return tuple(key) if isinstance(key, list) else key
+
+
+def encode_strategy(strategy: PatternIndexStrategy) -> List[Any]:
+    name = type(strategy).__name__
+    if _STRATEGIES.get(name) is not type(strategy):
+        raise InvalidOperationException(
+            message='Only the built-in pattern index strategies can be saved',
+            details=name,
+        )
+    return [name, vars(strategy)]
+
+
+def decode_strategy(data: List[Any]) -> PatternIndexStrategy:
+    name, parameters = data
+    if name not in _STRATEGIES:
+        raise InvalidOperationException(message='Unknown pattern index strategy', details=name)
+    return _STRATEGIES[name](**parameters)
+
+
+def encode_strategies(strategies: Dict[str, PatternIndexStrategy]) -> Dict[str, List[Any]]:
+    return {key: encode_strategy(strategy) for key, strategy in strategies.items()}
+
+
+def decode_strategies(data: Dict[str, List[Any]]) -> Dict[str, PatternIndexStrategy]:
+    return {key: decode_strategy(strategy) for key, strategy in data.items()}
+
+
+def copy_array(typecode: str, view: Any) -> array:
+    answer = array(typecode)
+    answer.frombytes(memoryview(view).cast('B'))
+    return answer
+
+
+class MappedIndex:
+    """
+    Read-only posting index (key -> sorted atom ids) over snapshot sections. Keys
+    are kept sorted by their encoding and found by binary search; postings are
+    memoryviews of the mapped file.
+    """
+
+    def __init__(self, keys: memoryview, key_offsets: memoryview, offsets: memoryview, values):
+        self.keys_data = keys
+        self.key_offsets = key_offsets
+        self.offsets = offsets
+        self.values_data = values
+
+    def __len__(self) -> int:
+        return len(self.key_offsets) - 1
+
+    def _key(self, position: int) -> bytes:
+        start, end = self.key_offsets[position], self.key_offsets[position + 1]
+        return self.keys_data[start:end].tobytes()
+
+    def _find(self, key: Any) -> Optional[int]:
+        encoded = encode_key(key)
+        low, high = 0, len(self)
+        while low < high:
+            middle = (low + high) // 2
+            if self._key(middle) < encoded:
+                low = middle + 1
+            else:
+                high = middle
+        if low < len(self) and self._key(low) == encoded:
+            return low
+        return None
+
+    def _postings(self, position: int) -> memoryview:
+        start, end = self.offsets[position], self.offsets[position + 1]
+        return self.values_data[start:end]
+
+    def get(self, key: Any, default: Any = None) -> Any:
+        position = self._find(key)
+        return default if position is None else self._postings(position)
+
+    def __getitem__(self, key: Any) -> memoryview:
+        position = self._find(key)
+        if position is None:
+            raise KeyError(key)
+        return self._postings(position)
+
+    def __contains__(self, key: Any) -> bool:
+        return self._find(key) is not None
+
+    def keys(self) -> Iterator[Any]:
+        return (decode_key(self._key(position)) for position in range(len(self)))
+
+    def values(self) -> Iterator[memoryview]:
+        return (self._postings(position) for position in range(len(self)))
+
+    def items(self) -> Iterator[Tuple[Any, memoryview]]:
+        return (
+            (decode_key(self._key(position)), self._postings(position))
+            for position in range(len(self))
+        )
+
+
+class MappedPostings:
+    """
+    Read-only posting index keyed by atom id (incomming_set), saved as one
+    offsets entry per atom id. Atoms without postings aren't keys.
+    """
+
+    def __init__(self, offsets: memoryview, values: memoryview) -> None:
+        self.offsets = offsets
+        self.values_data = values
+
+    def get(self, atom_id: Any, default: Any = None) -> Any:
+        if not isinstance(atom_id, int) or not 0 <= atom_id < len(self.offsets) - 1:
+            return default
+        start, end = self.offsets[atom_id], self.offsets[atom_id + 1]
+        return self.values_data[start:end] if end > start else default
+
+    def __getitem__(self, atom_id: int) -> memoryview:
+        postings = self.get(atom_id)
+        if postings is None:
+            raise KeyError(atom_id)
+        return postings
+
+    def __contains__(self, atom_id: Any) -> bool:
+        return self.get(atom_id) is not None
+
+    def __len__(self) -> int:
+        return sum(1 for _ in self.keys())
+
+    def keys(self) -> Iterator[int]:
+        offsets = self.offsets
+        return (
+            atom_id
+            for atom_id in range(len(offsets) - 1)
+            if offsets[atom_id + 1] > offsets[atom_id]
+        )
+
+    def values(self) -> Iterator[memoryview]:
+        return (self[atom_id] for atom_id in self.keys())
+
+    def items(self) -> Iterator[Tuple[int, memoryview]]:
+        return ((atom_id, self[atom_id]) for atom_id in self.keys())
+
+
+class MappedHandles:
+    """Handles by atom id, read from the mapped digests."""
+
+    def __init__(self, digests: memoryview, compact: bool) -> None:
+        self.digests = digests
+        self.compact = compact
+
+    def __len__(self) -> int:
+        return len(self.digests) // HANDLE_SIZE
+
+    def __getitem__(self, atom_id: int) -> Any:
+        if atom_id < 0:
+            atom_id += len(self)
+        start, end = atom_id * HANDLE_SIZE, (atom_id + 1) * HANDLE_SIZE
+        digest = self.digests[start:end].tobytes()
+        return digest if self.compact else digest.hex()
+
+    def __iter__(self) -> Iterator[Any]:
+        return (self[atom_id] for atom_id in range(len(self)))
+
+
+class MappedHandleTable:
+    """
+    Read-only HandleTable. Handles are found by binary search on the atom ids
+    sorted by digest.
+    """
+
+    def __init__(self, digests: memoryview, order: memoryview, compact: bool) -> None:
+        self.handles = MappedHandles(digests, compact)
+        self.order = order
+
+    def _digest(self, atom_id: int) -> bytes:
+        start, end = atom_id * HANDLE_SIZE, (atom_id + 1) * HANDLE_SIZE
+        return self.handles.digests[start:end].tobytes()
+
+    def get(self, handle: Any) -> Optional[int]:
+        if isinstance(handle, str):
+            try:
+                handle = bytes.fromhex(handle)
+            except ValueError:
+                return None
+        if not isinstance(handle, bytes) or len(handle) != HANDLE_SIZE:
+            return None
+        order = self.order
+        low, high = 0, len(order)
+        while low < high:
+            middle = (low + high) // 2
+            if self._digest(order[middle]) < handle:
+                low = middle + 1
+            else:
+                high = middle
+        if low < len(order) and self._digest(order[low]) == handle:
+            return order[low]
+        return None
+
+    def handle(self, atom_id: int) -> Any:
+        return self.handles[atom_id]
+
+    def intern(self, handle: Any) -> int:
+        raise InvalidOperationException(message='Snapshot databases are read-only')
+
+    def __len__(self) -> int:
+        return len(self.handles)
+
+
+class MappedDirectory(AtomDirectory):
+    """AtomDirectory whose kinds and type ids are mapped from a snapshot."""
+
+    def __init__(self, kinds: memoryview, type_ids: memoryview, types: List[str], count: int):
+        super().__init__()
+        self.kinds = kinds
+        self.type_ids = type_ids
+        for named_type in types:
+            self._type_ids[named_type] = len(self.types)
+            self.types.append(named_type)
+        self.count = count
+
+    def add(self, atom_id: int, kind: AtomKind, named_type: str) -> None:
+        raise InvalidOperationException(message='Snapshot databases are read-only')
+
+    def __len__(self) -> int:
+        return self.count
+
+
+class MappedNodes:
+    """Node documents, rebuilt from the mapped names and the directory."""
+
+    def __init__(
+        self,
+        handles: MappedHandleTable,
+        directory: AtomDirectory,
+        type_hashes: List[str],
+        names: memoryview,
+        name_offsets: memoryview,
+        attributes: Dict[int, Dict[str, Any]],
+        count: int,
+    ) -> None:
+        self.handles = handles
+        self.directory = directory
+        self.type_hashes = type_hashes
+        self.names = names
+        self.name_offsets = name_offsets
+        self.attributes = attributes
+        self.count = count
+
+    def __len__(self) -> int:
+        return self.count
+
+    def __contains__(self, node_id: Any) -> bool:
+        return self.directory.kind(node_id) == AtomKind.NODE
+
+    def get(self, node_id: Any, default: Any = None) -> Any:
+        if node_id not in self:
+            return default
+        start, end = self.name_offsets[node_id], self.name_offsets[node_id + 1]
+        type_id = self.directory.type_ids[node_id]
+        document = {
+            '_id': self.handles.handles[node_id],
+            'composite_type_hash': self.type_hashes[type_id],
+            'name': str(self.names[start:end], 'utf-8'),
+            'named_type': self.directory.types[type_id],
+        }
+        document.update(self.attributes.get(node_id, {}))
+        return document
+
+    def __getitem__(self, node_id: int) -> Dict[str, Any]:
+        document = self.get(node_id)
+        if document is None:
+            raise KeyError(node_id)
+        return document
+
+    def keys(self) -> Iterator[int]:
+        return (atom_id for atom_id in range(len(self.handles)) if atom_id in self)
+
+    def values(self) -> Iterator[Dict[str, Any]]:
+        return (self[node_id] for node_id in self.keys())
+
+    def items(self) -> Iterator[Tuple[int, Dict[str, Any]]]:
+        return ((node_id, self[node_id]) for node_id in self.keys())
+
+
+class SnapshotWriter:
+    def __init__(self, stream) -> None:
+        self.stream = stream
+        self.sections: Dict[str, Tuple[int, int, str]] = {}
+        stream.write(bytes(_PREAMBLE.size))
+
+    def _align(self) -> None:
+        padding = -self.stream.tell() % SECTION_ALIGNMENT
+        self.stream.write(bytes(padding))
+
+    def add_array(self, name: str, typecode: str, data: Any) -> None:
+        self._align()
+        data = memoryview(data).cast('B')
+        self.sections[name] = (self.stream.tell(), len(data), typecode)
+        self.stream.write(data)
+
+    def add_postings(self, name: str, index: Dict[int, Any], size: int) -> None:
+        offsets = array(ATOM_ID_TYPECODE, (0,))
+        self._align()
+        start = self.stream.tell()
+        total = 0
+        for atom_id in range(size):
+            postings = index.get(atom_id)
+            if postings:
+                self.stream.write(memoryview(postings).cast('B'))
+                total += len(postings)
+            offsets.append(total)
+        self.sections[f'{name}.values'] = (start, self.stream.tell() - start, ATOM_ID_TYPECODE)
+        self.add_array(f'{name}.offsets', ATOM_ID_TYPECODE, offsets)
+
+    def add_index(self, name: str, index: Dict[Any, Any]) -> None:
+        encoded = sorted((encode_key(key), key) for key in index.keys())
+        keys = bytearray()
+        key_offsets = array(ATOM_ID_TYPECODE, (0,))
+        offsets = array(ATOM_ID_TYPECODE, (0,))
+        self._align()
+        start = self.stream.tell()
+        total = 0
+        for encoded_key, key in encoded:
+            postings = index[key]
+            keys += encoded_key
+            key_offsets.append(len(keys))
+            self.stream.write(memoryview(postings).cast('B'))
+            total += len(postings)
+            offsets.append(total)
+        self.sections[f'{name}.values'] = (start, self.stream.tell() - start, ATOM_ID_TYPECODE)
+        self.add_array(f'{name}.keys', 'B', keys)
+        self.add_array(f'{name}.key_offsets', ATOM_ID_TYPECODE, key_offsets)
+        self.add_array(f'{name}.offsets', ATOM_ID_TYPECODE, offsets)
+
+    def close(self, header: Dict[str, Any]) -> None:
+        header = dict(header, sections=self.sections, byteorder=sys.byteorder)
+        try:
+            data = json.dumps(header, separators=(',', ':')).encode('utf-8')
+        except (TypeError, ValueError) as exception:
+            raise InvalidOperationException(
+                message='Only JSON values can be saved as custom attributes',
+                details=str(exception),
+            )
+        self._align()
+        offset = self.stream.tell()
+        self.stream.write(data)
+        self.stream.seek(0)
+        self.stream.write(_PREAMBLE.pack(SNAPSHOT_MAGIC, SNAPSHOT_VERSION, 0, offset, len(data)))
+
+
+class Snapshot:
+    """A memory mapped snapshot file. Sections are read as memoryviews of the mapping."""
+
+    def __init__(self, path: str) -> None:
+        with open(path, 'rb') as stream:
+            self.mapping = mmap.mmap(stream.fileno(), 0, access=mmap.ACCESS_READ)
+        magic, version, _, offset, size = _PREAMBLE.unpack_from(self.mapping)
+        if magic != SNAPSHOT_MAGIC or version != SNAPSHOT_VERSION:
+            raise InvalidOperationException(
+                message='Not a snapshot file or unsupported snapshot version',
+                details=f'{path}: version {version}',
+            )
+        end = offset + size
+        try:
+            self.header = json.loads(self.mapping[offset:end])
+        except ValueError:
+            raise InvalidOperationException(message='Invalid snapshot header', details=path)
+        if self.header['byteorder'] != sys.byteorder:
+            raise InvalidOperationException(
+                message='Snapshot saved with a different byte order',
+                details=f'{path}: {self.header["byteorder"]}',
+            )
+        self.view = memoryview(self.mapping)
+
+    def array(self, name: str) -> memoryview:
+        offset, size, typecode = self.header['sections'][name]
+        end = offset + size
+        return self.view[offset:end].cast(typecode)
+
+    def index(self, name: str) -> MappedIndex:
+        return MappedIndex(
+            self.array(f'{name}.keys'),
+            self.array(f'{name}.key_offsets'),
+            self.array(f'{name}.offsets'),
+            self.array(f'{name}.values'),
+        )
+
+    def postings(self, name: str) -> MappedPostings:
+        return MappedPostings(self.array(f'{name}.offsets'), self.array(f'{name}.values'))
+
+
+def _columnar_links(db: Database) -> ColumnarLink:
+    if isinstance(db.link, ColumnarLink):
+        return db.link
+    link = ColumnarLink(db.handles)
+    for table in db.link.all_tables():
+        for link_id, document in table.items():
+            link.add(link_id, document, db.outgoing_set[link_id])
+    return link
+
+
+def save_database(path: str, db: Database, header: Dict[str, Any]) -> None:
+    """
+    Writes db to path. Links are always saved in the layout of ColumnarLink, so
+    it's used to read them whatever the store of the saved database was.
+    """
+    size = len(db.handles)
+    directory = db.directory
+    link = _columnar_links(db)
+    temporary = f'{path}.tmp'
+    with open(temporary, 'wb') as stream:
+        writer = SnapshotWriter(stream)
+        digests = bytearray()
+        for handle in db.handles.handles:
+            digests += handle if isinstance(handle, bytes) else bytes.fromhex(handle)
+        writer.add_array('handles', 'B', digests)
+        handle_table = MappedHandleTable(memoryview(digests), id_array(), compact=True)
+        order = sorted(range(size), key=handle_table._digest)
+        writer.add_array('handle_order', ATOM_ID_TYPECODE, id_array(order))
+        writer.add_array('kinds', 'B', bytes(directory.kinds) + bytes(size - len(directory.kinds)))
+        type_ids = copy_array('i', directory.type_ids)
+        type_ids.extend(array('i', (0,)) * (size - len(type_ids)))
+        writer.add_array('type_ids', 'i', type_ids)
+
+        names = bytearray()
+        name_offsets = array(ATOM_ID_TYPECODE, (0,))
+        node_attributes = {}
+        for atom_id in range(size):
+            node = db.node.get(atom_id)
+            if node is not None:
+                names += node['name'].encode('utf-8')
+                attributes = {
+                    key: value
+                    for key, value in node.items()
+                    if key not in ('_id', 'composite_type_hash', 'name', 'named_type')
+                }
+                if attributes:
+                    node_attributes[atom_id] = attributes
+            name_offsets.append(len(names))
+        writer.add_array('names', 'B', names)
+        writer.add_array('name_offsets', ATOM_ID_TYPECODE, name_offsets)
+
+        writer.add_array('link.buckets', 'B', link.buckets)
+        writer.add_array('link.rows', ATOM_ID_TYPECODE, link.rows)
+        for table in link.all_tables():
+            prefix = f'link.{table.bucket}'
+            writer.add_array(f'{prefix}.link_ids', ATOM_ID_TYPECODE, table.link_ids)
+            writer.add_array(f'{prefix}.type_ids', 'i', table.type_ids)
+            writer.add_array(f'{prefix}.toplevel', 'B', table.toplevel)
+            targets, offsets = table.compacted()
+            writer.add_array(f'{prefix}.targets', ATOM_ID_TYPECODE, targets)
+            writer.add_array(f'{prefix}.offsets', ATOM_ID_TYPECODE, offsets)
+
+        writer.add_postings('incomming_set', db.incomming_set, size)
+        for name in KEYED_INDEXES:
+            writer.add_index(name, getattr(db, name))
+
+        writer.close(
+            dict(
+                header,
+                metadata=db.metadata,
+                atom_type=db.atom_type,
+                size=size,
+                atoms=len(directory),
+                nodes=len(db.node),
+                types=list(directory.types),
+                link_types=link.types,
+                link_attributes=link.attributes,
+                node_attributes=node_attributes,
+            )
+        )
+    os.replace(temporary, path)
+
+
+def _atom_id_keys(table: Dict[str, Any]) -> Dict[int, Any]:
+    # JSON object keys are strings
+    return {int(atom_id): value for atom_id, value in table.items()}
+
+
+def open_database(snapshot: Snapshot, named_type_hash) -> Database:
+    """Database whose atoms and indexes are read from the mapped snapshot."""
+    header = snapshot.header
+    compact = header['compact_handles']
+    handles = MappedHandleTable(snapshot.array('handles'), snapshot.array('handle_order'), compact)
+    directory = MappedDirectory(
+        snapshot.array('kinds'), snapshot.array('type_ids'), header['types'], header['atoms']
+    )
+    node = MappedNodes(
+        handles,
+        directory,
+        [named_type_hash(named_type) for named_type in header['types']],
+        snapshot.array('names'),
+        snapshot.array('name_offsets'),
+        _atom_id_keys(header['node_attributes']),
+        header['nodes'],
+    )
+    link = ColumnarLink(handles)
+    link.types = [tuple(types) for types in header['link_types']]
+    link.type_ids = {types[3]: type_id for type_id, types in enumerate(link.types)}
+    link.attributes = _atom_id_keys(header['link_attributes'])
+    link.buckets = snapshot.array('link.buckets')
+    link.rows = snapshot.array('link.rows')
+    for table in link.all_tables():
+        prefix = f'link.{table.bucket}'
+        table.link_ids = snapshot.array(f'{prefix}.link_ids')
+        table.type_ids = snapshot.array(f'{prefix}.type_ids')
+        table.toplevel = snapshot.array(f'{prefix}.toplevel')
+        table.targets = snapshot.array(f'{prefix}.targets')
+        table.offsets = snapshot.array(f'{prefix}.offsets')
+    db = Database(
+        atom_type=header['atom_type'],
+        node=node,
+        link=link,
+        outgoing_set=link.outgoing_set(),
+        incomming_set=snapshot.postings('incomming_set'),
+        patterns=None,
+        templates=None,
+        metadata=header['metadata'],
+        handles=handles,
+        directory=directory,
+    )
+    for name in KEYED_INDEXES:
+        setattr(db, name, snapshot.index(name))
+    return db
+
+
+def thaw_database(db: Database, columnar_links: bool) -> Database:
+    """Copies a database opened by open_database into regular (writable) structures."""
+    handles = HandleTable()
+    for handle in db.handles.handles:
+        handles.intern(handle)
+
+    directory = AtomDirectory()
+    directory.kinds = bytearray(db.directory.kinds)
+    directory.type_ids = copy_array('i', db.directory.type_ids)
+    for named_type in db.directory.types:
+        directory._type_ids[named_type] = len(directory.types)
+        directory.types.append(named_type)
+
+    mapped = db.link
+    columnar = ColumnarLink(handles)
+    columnar.types = list(mapped.types)
+    columnar.type_ids = dict(mapped.type_ids)
+    columnar.attributes = dict(mapped.attributes)
+    columnar.buckets = bytearray(mapped.buckets)
+    columnar.rows = copy_array(ATOM_ID_TYPECODE, mapped.rows)
+    for table, mapped_table in zip(columnar.all_tables(), mapped.all_tables()):
+        table.link_ids = copy_array(ATOM_ID_TYPECODE, mapped_table.link_ids)
+        table.type_ids = copy_array('i', mapped_table.type_ids)
+        table.toplevel = bytearray(mapped_table.toplevel)
+        table.targets = copy_array(ATOM_ID_TYPECODE, mapped_table.targets)
+        table.offsets = copy_array(ATOM_ID_TYPECODE, mapped_table.offsets)
+    if columnar_links:
+        link = columnar
+        outgoing_set = columnar.outgoing_set()
+    else:
+        link = Link(arity_1={}, arity_2={}, arity_n={})
+        outgoing_set = {}
+        for table, columnar_table in zip(link.all_tables(), columnar.all_tables()):
+            for row, link_id in enumerate(columnar_table.link_ids):
+                table[link_id] = columnar.build_document(columnar_table, row)
+                outgoing_set[link_id] = columnar_table.row_targets(row)
+
+    node = {}
+    for node_id, document in db.node.items():
+        document['_id'] = handles.handles[node_id]
+        node[node_id] = document
+
+    answer = Database(
+        atom_type=dict(db.atom_type),
+        node=node,
+        link=link,
+        outgoing_set=outgoing_set,
+        incomming_set={
+            atom_id: copy_array(ATOM_ID_TYPECODE, postings)
+            for atom_id, postings in db.incomming_set.items()
+        },
+        patterns=None,
+        templates=None,
+        metadata=dict(db.metadata),
+        handles=handles,
+        directory=directory,
+    )
+    for name in KEYED_INDEXES:
+        index = {
+            key: copy_array(ATOM_ID_TYPECODE, postings)
+            for key, postings in getattr(db, name).items()
+        }
+        setattr(answer, name, index)
+    return answer
@@ -0,0 +1,60 @@
+from array import array
+from typing import Dict, List, Optional, Set
+
+from hyperon_das_atomdb.entity import id_array
+from hyperon_das_atomdb.utils.postings import add_posting, intersect, remove_posting
+
+TRIGRAM_SIZE = 3
+
+
+def trigrams(text: str) -> Set[str]:
+    answer = set()
+    for start in range(len(text) - TRIGRAM_SIZE + 1):
+        end = start + TRIGRAM_SIZE
+        answer.add(text[start:end])
+    return answer
+
+
+class TrigramIndex:
+    """
+    Trigram postings (sorted node ids) of node names, partitioned by node type.
+    Candidates still have to be verified since a name having all the trigrams
+    of a substring doesn't mean it contains the substring.
+    """
+
+    def __init__(self) -> None:
+        self.partitions: Dict[str, Dict[str, array]] = {}
+
+    def add(self, node_type_hash: str, node_id: int, name: str) -> None:
+        partition = self.partitions.setdefault(node_type_hash, {})
+        for trigram in trigrams(name):
+            postings = partition.get(trigram)
+            if postings is None:
+                partition[trigram] = id_array((node_id,))
+            else:
+                add_posting(postings, node_id)
+
+    def remove(self, node_type_hash: str, node_id: int, name: str) -> None:
+        partition = self.partitions.get(node_type_hash, {})
+        for trigram in trigrams(name):
+            postings = partition.get(trigram)
+            if postings is not None and remove_posting(postings, node_id) and not postings:
+                del partition[trigram]
+
+    def candidates(self, node_type_hash: str, substring: str) -> Optional[List[int]]:
+        """
+        Ids of the nodes of the type whose names may contain substring, or None
+        if substring is too short to be narrowed by trigrams.
+        """
+        if len(substring) < TRIGRAM_SIZE:
+            return None
+        partition = self.partitions.get(node_type_hash)
+        if partition is None:
+            return []
+        postings = []
+        for trigram in trigrams(substring):
+            trigram_postings = partition.get(trigram)
+            if trigram_postings is None:
+                return []
+            postings.append(trigram_postings)
+        return intersect(*postings)
@@ -1,14 +1,26 @@
+import gc
+import threading
+from typing import Iterator
+
 import pytest
 
 from hyperon_das_atomdb.adapters.ram_only import InMemoryDB
+from hyperon_das_atomdb.entity import AtomKind, LinkColumns
 from hyperon_das_atomdb.exceptions import (
     AddLinkException,
     AddNodeException,
     AtomDoesNotExist,
+    InvalidHashScheme,
+    InvalidOperationException,
     LinkDoesNotExist,
     NodeDoesNotExist,
 )
 from hyperon_das_atomdb.utils.expression_hasher import ExpressionHasher
+from hyperon_das_atomdb.utils.patterns import (
+    BoundedPatternIndex,
+    FullPatternIndex,
+    PositionalPatternIndex,
+)
 
 
 class TestInMemoryDB:
@@ -219,13 +231,37 @@ class TestInMemoryDB:
         ]
 
     @pytest.fixture()
-    def database(self, all_nodes, all_links):
-        db = InMemoryDB()
-        for node in all_nodes:
-            db.add_node(node)
-        for link in all_links:
-            db.add_link(link)
-        return db
+    def nested_link(self):
+        # Its second target is a link too, which isn't toplevel
+        return {
+            'type': 'Evaluation',
+            'targets': [
+                {'type': 'Predicate', 'name': 'Predicate:has_name'},
+                {
+                    'type': 'Evaluation',
+                    'targets': [
+                        {'type': 'Concept', 'name': 'human'},
+                        {'type': 'Concept', 'name': 'chimp'},
+                    ],
+                },
+            ],
+        }
+
+    @pytest.fixture()
+    def build_db(self, all_nodes, all_links):
+        def build(nodes=None, links=None, **options):
+            db = InMemoryDB(**options)
+            for node in all_nodes if nodes is None else nodes:
+                db.add_node(node)
+            for link in all_links if links is None else links:
+                db.add_link(link)
+            return db
+
+        return build
+
+    @pytest.fixture()
+    def database(self, build_db):
+        return build_db()
 
     def test_get_node_handle(self, database: InMemoryDB):
         actual = database.get_node_handle(node_type="Concept", node_name="human")
@@ -433,12 +469,16 @@ class TestInMemoryDB:
         assert len(actual) == 2
 
     def test_get_all_nodes(self, database):
-        ret = database.get_all_nodes('Concept')
+        ret = list(database.get_all_nodes('Concept'))
         assert len(ret) == 14
-        ret = database.get_all_nodes('Concept', True)
+        ret = list(database.get_all_nodes('Concept', True))
         assert len(ret) == 14
-        ret = database.get_all_nodes('ConceptFake')
+        ret = list(database.get_all_nodes('ConceptFake'))
         assert len(ret) == 0
+        database.add_node({'type': 'Predicate', 'name': 'Predicate:has_name'})
+        database.add_node({'type': 'Predicate', 'name': 'Predicate:has_name'})
+        assert list(database.get_all_nodes('Predicate', True)) == ['Predicate:has_name']
+        assert len(list(database.get_all_nodes('Concept'))) == 14
 
     def test_get_matched_type_template(self, database: InMemoryDB):
         v1 = database.get_matched_type_template(['Inheritance', 'Concept', 'Concept'])
@@ -574,9 +614,9 @@ class TestInMemoryDB:
         assert exc_info.value.args[0] == 'The "name" and "type" fields must be sent'
 
     def test_add_node(self, database: InMemoryDB):
-        assert len(database.get_all_nodes('Concept')) == 14
+        assert len(list(database.get_all_nodes('Concept'))) == 14
         database.add_node({'type': 'Concept', 'name': 'car'})
-        assert len(database.get_all_nodes('Concept')) == 15
+        assert len(list(database.get_all_nodes('Concept'))) == 15
         node_handle = database.get_node_handle('Concept', 'car')
         node_name = database.get_node_name(node_handle)
         assert node_name == 'car'
@@ -687,3 +727,725 @@ class TestInMemoryDB:
         atom = database.get_atom_as_dict(handle=s)
         assert atom['handle'] == s
         assert atom['targets'] == [h, m]
+
+    def test_compact_handles(self, database: InMemoryDB, build_db):
+        compact_db = build_db(compact_handles=True)
+
+        for key in compact_db.db.handles.handles:
+            assert isinstance(key, bytes) and len(key) == 16
+        for value in compact_db.db.node.values():
+            assert isinstance(value['_id'], bytes) and len(value['_id']) == 16
+
+        human = compact_db.get_node_handle('Concept', 'human')
+        chimp = compact_db.get_node_handle('Concept', 'chimp')
+        assert human == database.get_node_handle('Concept', 'human')
+        assert compact_db.get_node_name(human) == 'human'
+        assert compact_db.get_node_type(human) == 'Concept'
+        link = compact_db.get_link_handle('Similarity', [human, chimp])
+        assert link == 'b5459e299a5c5e8662c427f7e01b3bf1'
+        assert compact_db.get_link_type(link) == 'Similarity'
+        assert compact_db.get_link_targets(link) == [human, chimp]
+        assert compact_db.is_ordered(link)
+        assert compact_db.get_atom(link) == database.get_atom(link)
+        assert compact_db.get_atom_as_dict(link) == database.get_atom_as_dict(link)
+        assert compact_db.get_atom_as_dict(human) == database.get_atom_as_dict(human)
+        assert sorted(compact_db.get_all_nodes('Concept')) == sorted(
+            database.get_all_nodes('Concept')
+        )
+        assert sorted(compact_db.get_matched_node_name('Concept', 'ma')) == sorted(
+            database.get_matched_node_name('Concept', 'ma')
+        )
+        assert compact_db.get_matched_links('Similarity', ['*', chimp]) == (
+            database.get_matched_links('Similarity', ['*', chimp])
+        )
+        assert compact_db.get_matched_type_template(['Inheritance', 'Concept', 'Concept']) == (
+            database.get_matched_type_template(['Inheritance', 'Concept', 'Concept'])
+        )
+        assert compact_db.get_matched_type('Similarity') == database.get_matched_type('Similarity')
+        assert compact_db.count_atoms() == database.count_atoms()
+
+        with pytest.raises(LinkDoesNotExist):
+            compact_db.get_link_targets('link_handle_Fake')
+        with pytest.raises(AtomDoesNotExist):
+            compact_db.get_atom('test')
+
+    def test_node_handles_and_link_handles(self, database: InMemoryDB):
+        human, chimp = database.node_handles([('Concept', 'human'), ('Concept', 'chimp')])
+        assert human == database.get_node_handle('Concept', 'human')
+        assert chimp == database.get_node_handle('Concept', 'chimp')
+        links = [('Similarity', [human, chimp]), ('Inheritance', [chimp, human])]
+        assert database.link_handles(links) == [database.link_handle(t, h) for t, h in links]
+        assert database.link_handles(links)[0] == 'b5459e299a5c5e8662c427f7e01b3bf1'
+
+    def test_hash_scheme(self, database: InMemoryDB, build_db):
+        db = build_db(hash_scheme='blake2b-128')
+        assert db.db.metadata['hash_scheme'] == 'blake2b-128'
+        assert database.db.metadata['hash_scheme'] == 'md5'
+        human = db.get_node_handle('Concept', 'human')
+        chimp = db.get_node_handle('Concept', 'chimp')
+        assert human != database.get_node_handle('Concept', 'human')
+        assert human == ExpressionHasher.for_scheme('blake2b-128').terminal_hash('Concept', 'human')
+        link = db.get_link_handle('Similarity', [human, chimp])
+        assert db.get_link_targets(link) == [human, chimp]
+        assert len(db.get_matched_links('Similarity', ['*', chimp])) == 2
+        assert len(db.get_matched_type_template(['Inheritance', 'Concept', 'Concept'])) == 12
+        assert len(db.get_matched_type('Similarity')) == 14
+        db._check_hash_scheme(db.db.metadata)
+        with pytest.raises(InvalidHashScheme):
+            db._check_hash_scheme(database.db.metadata)
+        db.clear_database()
+        assert db.count_atoms() == (0, 0)
+        assert db.db.metadata['hash_scheme'] == 'blake2b-128'
+
+    @pytest.mark.parametrize(
+        'options',
+        [
+            {'pattern_index_strategy': BoundedPatternIndex(0)},
+            {'pattern_index_strategy': BoundedPatternIndex(1)},
+            {'pattern_index_strategy': BoundedPatternIndex(2)},
+            {'pattern_index_strategy': PositionalPatternIndex()},
+            {'pattern_index_strategy': PositionalPatternIndex(), 'compact_handles': True},
+            {'pattern_index_strategy': PositionalPatternIndex(), 'columnar_links': True},
+            {'pattern_index_strategy': BoundedPatternIndex(1), 'columnar_links': True},
+            {'link_type_pattern_index': {'Similarity': PositionalPatternIndex()}},
+            {
+                'pattern_index_strategy': BoundedPatternIndex(1),
+                'link_type_pattern_index': {
+                    'Inheritance': PositionalPatternIndex(),
+                    'Evaluation': FullPatternIndex(),
+                },
+            },
+        ],
+    )
+    def test_pattern_index_strategies(self, database: InMemoryDB, build_db, nested_link, options):
+        db = build_db(**options)
+        db.add_link(nested_link)
+        database.add_link(nested_link)
+        if 'pattern_index_strategy' in options:
+            assert len(db.db.patterns) < len(database.db.patterns)
+
+        human = db.get_node_handle('Concept', 'human')
+        chimp = db.get_node_handle('Concept', 'chimp')
+        predicate = db.get_node_handle('Predicate', 'Predicate:has_name')
+        queries = [
+            ('Similarity', ['*', chimp]),
+            ('Similarity', [human, '*']),
+            ('Similarity', ['*', '*']),
+            ('Inheritance', ['*', '*']),
+            ('Evaluation', [predicate, '*']),
+            ('Evaluation', ['*', '*']),
+            ('*', [human, chimp]),
+            ('*', ['*', chimp]),
+            ('*', [human, '*']),
+            ('*', ['*', '*']),
+            ('Similarity', ['*', predicate]),
+            ('Similarity', ['*']),
+        ]
+        for link_type, targets in queries:
+            expected = database.get_matched_links(link_type, targets)
+            assert sorted(db.get_matched_links(link_type, targets)) == sorted(expected)
+            expected = database.get_matched_links(link_type, targets, {'toplevel_only': True})
+            actual = db.get_matched_links(link_type, targets, {'toplevel_only': True})
+            assert sorted(actual) == sorted(expected)
+
+    def test_pattern_index_high_arity(self):
+        db = InMemoryDB(link_type_pattern_index={'Set': PositionalPatternIndex()})
+        targets = [{'type': 'Concept', 'name': str(i)} for i in range(30)]
+        link = db.add_link({'type': 'Set', 'targets': targets})
+        handles = [db.get_node_handle('Concept', str(i)) for i in range(30)]
+        assert len(db.db.patterns) == 0
+        assert db.get_matched_links('Set', ['*'] * 30) == [(link['_id'], tuple(handles))]
+        query = ['*'] * 30
+        query[7] = handles[7]
+        query[21] = handles[21]
+        assert db.get_matched_links('Set', query) == [(link['_id'], tuple(handles))]
+        assert db.get_matched_links('*', query) == [(link['_id'], tuple(handles))]
+        query[21] = handles[20]
+        assert db.get_matched_links('Set', query) == []
+        assert db.get_matched_links('Set', ['*'] * 29) == []
+
+    def test_bounded_pattern_index(self):
+        with pytest.raises(ValueError):
+            BoundedPatternIndex(-1)
+        assert BoundedPatternIndex(1).indexes(['t', '*', 'b'])
+        assert not BoundedPatternIndex(1).indexes(['*', '*', 'b'])
+
+    def test_interned_type_hashes(self, database: InMemoryDB):
+        human = database.db.node[database._get_id(database.get_node_handle('Concept', 'human'))]
+        chimp = database.db.node[database._get_id(database.get_node_handle('Concept', 'chimp'))]
+        assert human['composite_type_hash'] is chimp['composite_type_hash']
+        links = list(database.db.link.arity_2.values())
+        assert links[0]['composite_type_hash'] is links[1]['composite_type_hash']
+        assert database.get_atom_as_dict(links[0]['_id'])['template'] == [
+            'Similarity',
+            'Concept',
+            'Concept',
+        ]
+
+    def test_atom_ids(self, database: InMemoryDB):
+        handles = database.db.handles
+        nodes, links = database.count_atoms()
+        assert len(handles) == nodes + links
+        human = database.get_node_handle('Concept', 'human')
+        chimp = database.get_node_handle('Concept', 'chimp')
+        link = database.get_link_handle('Similarity', [human, chimp])
+        human_id, chimp_id, link_id = [handles.get(handle) for handle in [human, chimp, link]]
+        assert handles.handle(link_id) == link
+        assert list(database.db.outgoing_set[link_id]) == [human_id, chimp_id]
+        assert link_id in database.db.incomming_set[human_id]
+        # Documents share the interned handles
+        document = database.db.link.arity_2[link_id]
+        assert document['_id'] is handles.handle(link_id)
+        assert document['key_0'] is handles.handle(human_id)
+        # Adding an atom again keeps its id
+        database.add_node({'type': 'Concept', 'name': 'human'})
+        assert handles.get(human) == human_id
+        assert len(handles) == nodes + links
+
+    @pytest.mark.parametrize('compact_handles', [False, True])
+    def test_columnar_links(
+        self, database: InMemoryDB, build_db, all_links, nested_link, compact_handles
+    ):
+        extra_links = [
+            {
+                'type': 'List',
+                'targets': [
+                    {'type': 'Concept', 'name': 'human'},
+                    {'type': 'Concept', 'name': 'chimp'},
+                    {'type': 'Concept', 'name': 'monkey'},
+                ],
+                'weight': 0.5,
+            },
+            nested_link,
+        ]
+        db = build_db(
+            links=all_links + extra_links, columnar_links=True, compact_handles=compact_handles
+        )
+        for link in extra_links:
+            database.add_link(link)
+        assert isinstance(db.db.link.arity_2, LinkColumns)
+        assert db.count_atoms() == database.count_atoms()
+
+        for table in database.db.link.all_tables():
+            for document in table.values():
+                handle = document['_id']
+                assert db.get_atom(handle) == database.get_atom(handle)
+                assert db.get_atom_as_dict(handle) == database.get_atom_as_dict(handle)
+                assert db.get_link_targets(handle) == database.get_link_targets(handle)
+                assert db.get_link_type(handle) == database.get_link_type(handle)
+        link = db.get_link_handle(
+            'List',
+            [
+                db.get_node_handle('Concept', 'human'),
+                db.get_node_handle('Concept', 'chimp'),
+                db.get_node_handle('Concept', 'monkey'),
+            ],
+        )
+        assert db.get_atom(link)['weight'] == 0.5
+        assert db.get_matched_type('Evaluation', {'toplevel_only': True}) == (
+            database.get_matched_type('Evaluation', {'toplevel_only': True})
+        )
+        with pytest.raises(LinkDoesNotExist):
+            db.get_link_targets(db.get_node_handle('Concept', 'human'))
+
+        # Adding a link again updates its row
+        inner = db.get_matched_type('Evaluation')[0][0]
+        assert db.get_atom(inner)['is_toplevel'] is False
+        db.add_link(extra_links[1]['targets'][1])
+        assert db.get_atom(inner)['is_toplevel'] is True
+        assert db.count_atoms() == database.count_atoms()
+
+    def test_columnar_arity_n_removal(self, build_db):
+        concepts = [{'type': 'Concept', 'name': f'c{n}'} for n in range(8)]
+        links = [{'type': 'List', 'targets': concepts[: 3 + n % 5]} for n in range(5)]
+        links += [{'type': 'Set', 'targets': concepts[: 3 + n]} for n in range(5)]
+        db = build_db(nodes=concepts, links=[], columnar_links=True)
+        handles = [db.add_link(link)['_id'] for link in links]
+        expected = {handle: db.get_link_targets(handle) for handle in handles}
+        table = db.db.link.arity_n
+        size = len(table.targets)
+        # The last row moves into the removed one; its targets stay where they were
+        db.delete_atom(handles[0])
+        assert len(table.targets) == size and table.garbage == 3
+        for handle in handles[1:7]:
+            db.delete_atom(handle)
+        # Compacted once the garbage outnumbered the live targets
+        assert table.garbage <= len(table.targets) // 2
+        assert len(table.targets) - table.garbage == sum(
+            len(expected[handle]) for handle in handles[7:]
+        )
+        for handle in handles[7:]:
+            assert db.get_link_targets(handle) == expected[handle]
+        assert db.count_atoms() == (len(concepts), 3)
+
+    def test_sorted_postings(self, database: InMemoryDB, all_links):
+        human = database.get_node_handle('Concept', 'human')
+        expected = database.get_matched_links('Similarity', [human, '*'])
+        for link in all_links:
+            database.add_link(link)
+        assert database.get_matched_links('Similarity', [human, '*']) == expected
+        indexes = [database.db.incomming_set, database.db.patterns, database.db.templates]
+        for index in indexes:
+            for postings in index.values():
+                assert list(postings) == sorted(set(postings))
+
+    def test_toplevel_partitions(self, database: InMemoryDB):
+        similarity = {
+            'type': 'Similarity',
+            'targets': [
+                {'type': 'Concept', 'name': 'human'},
+                {'type': 'Concept', 'name': 'snake'},
+            ],
+        }
+        evaluation = {
+            'type': 'Evaluation',
+            'targets': [{'type': 'Predicate', 'name': 'Predicate:has_name'}, similarity],
+        }
+        database.add_link(similarity)
+        link_handle = database.get_link_handle(
+            'Similarity',
+            [
+                database.get_node_handle('Concept', 'human'),
+                database.get_node_handle('Concept', 'snake'),
+            ],
+        )
+        toplevel = {'toplevel_only': True}
+
+        def handles(matches):
+            return [link_handle for link_handle, _ in matches]
+
+        assert link_handle in handles(
+            database.get_matched_links('Similarity', ['*', '*'], toplevel)
+        )
+        database.add_link(evaluation)
+        assert link_handle not in handles(
+            database.get_matched_links('Similarity', ['*', '*'], toplevel)
+        )
+        assert link_handle not in handles(database.get_matched_type('Similarity', toplevel))
+        assert link_handle in handles(database.get_matched_type('Similarity'))
+        for link_type, targets in [
+            ('Similarity', ['*', '*']),
+            ('Evaluation', ['*', '*']),
+            ('Inheritance', ['*', database.get_node_handle('Concept', 'mammal')]),
+        ]:
+            everything = database.get_matched_links(link_type, targets)
+            assert database.get_matched_links(link_type, targets, toplevel) == [
+                match for match in everything if database.get_atom(match[0])['is_toplevel']
+            ]
+
+    def test_paginated_matches(self, database: InMemoryDB):
+        human = database.get_node_handle('Concept', 'human')
+        queries = [
+            lambda parameters: database.get_matched_links('Similarity', ['*', '*'], parameters),
+            lambda parameters: database.get_matched_links('Inheritance', [human, '*'], parameters),
+            lambda parameters: database.get_matched_type('Inheritance', parameters),
+            lambda parameters: database.get_matched_type_template(
+                ['Similarity', 'Concept', 'Concept'], parameters
+            ),
+        ]
+        for query in queries:
+            expected = query(None)
+            for page_size in [1, 3, 100]:
+                pages = []
+                cursor, matches = query({'cursor': 0, 'page_size': page_size})
+                pages.extend(matches)
+                while cursor:
+                    assert len(matches) == page_size
+                    cursor, matches = query({'cursor': cursor, 'page_size': page_size})
+                    pages.extend(matches)
+                assert pages == expected
+        for page_size in [0, -3, 1.5, '10']:
+            with pytest.raises(InvalidOperationException):
+                queries[0]({'cursor': 0, 'page_size': page_size})
+        handle, targets = database.get_matched_links('Similarity', [human, '*'])[0]
+        assert database.get_matched_links('Similarity', list(targets), {'cursor': 0}) == (
+            0,
+            [handle],
+        )
+
+    @pytest.mark.parametrize(
+        'options',
+        [
+            {},
+            {'compact_handles': True},
+            {'columnar_links': True, 'trigram_index': True},
+            {'pattern_index_strategy': PositionalPatternIndex(), 'compact_handles': True},
+            {'link_type_pattern_index': {'Similarity': BoundedPatternIndex(1)}},
+        ],
+    )
+    def test_snapshot(self, tmp_path, build_db, all_nodes, all_links, nested_link, options):
+        predicate, inner = nested_link['targets']
+        predicate['weight'] = 2
+        inner['weight'] = 0.5
+        db = build_db(links=all_links + [nested_link], **options)
+        path = str(tmp_path / 'das.snapshot')
+        db.save_snapshot(path)
+        snapshot = InMemoryDB.open_snapshot(path, trigram_index=options.get('trigram_index'))
+        assert snapshot._snapshot is not None
+        assert snapshot.count_atoms() == db.count_atoms()
+
+        for handle in db.db.handles.handles:
+            handle = db.handle_codec.decode(handle)
+            assert snapshot.get_atom(handle) == db.get_atom(handle)
+            assert snapshot.get_atom_as_dict(handle) == db.get_atom_as_dict(handle)
+        human = db.get_node_handle('Concept', 'human')
+        chimp = db.get_node_handle('Concept', 'chimp')
+        queries = [
+            ('Similarity', ['*', chimp]),
+            ('Similarity', [human, '*']),
+            ('Inheritance', ['*', '*']),
+            ('Evaluation', ['*', '*']),
+            ('*', ['*', chimp]),
+            ('*', [human, chimp]),
+        ]
+        for link_type, targets in queries:
+            for parameters in [None, {'toplevel_only': True}]:
+                expected = db.get_matched_links(link_type, targets, parameters)
+                assert snapshot.get_matched_links(link_type, targets, parameters) == expected
+        assert snapshot.get_matched_type('Similarity') == db.get_matched_type('Similarity')
+        template = ['Similarity', 'Concept', 'Concept']
+        assert snapshot.get_matched_type_template(template) == db.get_matched_type_template(
+            template
+        )
+        assert list(snapshot.get_matched_node_name('Concept', 'ma')) == list(
+            db.get_matched_node_name('Concept', 'ma')
+        )
+        assert list(snapshot.get_all_nodes('Concept', True)) == list(
+            db.get_all_nodes('Concept', True)
+        )
+        assert snapshot.get_link_targets(snapshot.get_matched_type('Evaluation')[0][0])
+
+        # A snapshot of a snapshot has the same atoms
+        snapshot.save_snapshot(path)
+        reopened = InMemoryDB.open_snapshot(path)
+        assert reopened.get_matched_type('Inheritance') == db.get_matched_type('Inheritance')
+
+        # Writes copy the snapshot into regular structures first
+        link = {'type': 'Similarity', 'targets': [all_nodes[0], all_nodes[-1]]}
+        snapshot.add_link(link)
+        db.add_link(link)
+        assert snapshot._snapshot is None
+        assert snapshot.get_matched_links('Similarity', [human, '*']) == db.get_matched_links(
+            'Similarity', [human, '*']
+        )
+        assert list(snapshot.get_matched_node_name('Concept', 'ma')) == list(
+            db.get_matched_node_name('Concept', 'ma')
+        )
+        assert (snapshot.db.node_names is not None) == bool(options.get('trigram_index'))
+        assert snapshot.count_atoms() == db.count_atoms()
+
+    def test_snapshot_hash_scheme(self, tmp_path, all_nodes):
+        db = InMemoryDB(hash_scheme='blake2b-128')
+        db.add_node(all_nodes[0])
+        path = str(tmp_path / 'das.snapshot')
+        db.save_snapshot(path)
+        snapshot = InMemoryDB.open_snapshot(path)
+        assert snapshot.hasher.hash_scheme == 'blake2b-128'
+        assert snapshot.get_node_handle(all_nodes[0]['type'], all_nodes[0]['name'])
+        with pytest.raises(InvalidHashScheme):
+            InMemoryDB.open_snapshot(path, hash_scheme='md5')
+
+    @pytest.mark.parametrize(
+        'options',
+        [
+            {},
+            {'columnar_links': True, 'trigram_index': True},
+            {'pattern_index_strategy': PositionalPatternIndex(), 'compact_handles': True},
+            {'pattern_index_strategy': BoundedPatternIndex(1), 'columnar_links': True},
+        ],
+    )
+    def test_delete_atom(self, build_db, all_nodes, all_links, nested_link, options):
+        def build(nodes, links):
+            return build_db(nodes, links, **options)
+
+        def mentions(atom, name):
+            if 'targets' in atom:
+                return any(mentions(target, name) for target in atom['targets'])
+            return atom['name'] == name
+
+        def assert_same(db, expected):
+            assert db.count_atoms() == expected.count_atoms()
+            indexes = ['patterns', 'templates', 'toplevel_patterns', 'toplevel_templates']
+            for name in indexes + ['positions', 'nodes_by_type']:
+                assert len(getattr(db.db, name)) == len(getattr(expected.db, name))
+            human = expected.get_node_handle('Concept', 'human')
+            queries = [
+                ('Similarity', [human, '*']),
+                ('Similarity', ['*', '*']),
+                ('Inheritance', ['*', '*']),
+                ('Evaluation', ['*', '*']),
+                ('*', ['*', '*']),
+            ]
+            for link_type, targets in queries:
+                for parameters in [None, {'toplevel_only': True}]:
+                    assert sorted(db.get_matched_links(link_type, targets, parameters)) == sorted(
+                        expected.get_matched_links(link_type, targets, parameters)
+                    )
+            for link_type in ['Similarity', 'Inheritance', 'Evaluation']:
+                assert sorted(db.get_matched_type(link_type)) == sorted(
+                    expected.get_matched_type(link_type)
+                )
+            assert sorted(db.get_all_nodes('Concept')) == sorted(expected.get_all_nodes('Concept'))
+            assert sorted(db.get_matched_node_name('Concept', 'mam')) == sorted(
+                expected.get_matched_node_name('Concept', 'mam')
+            )
+
+        db = build(all_nodes, all_links + [nested_link])
+        human = db.get_node_handle('Concept', 'human')
+        chimp = db.get_node_handle('Concept', 'chimp')
+        with pytest.raises(InvalidOperationException):
+            db.delete_atom(human)
+        with pytest.raises(AtomDoesNotExist):
+            db.delete_atom('0' * 32)
+
+        # Only the atom goes, its targets stay
+        monkey = db.get_node_handle('Concept', 'monkey')
+        db.delete_atom(db.get_link_handle('Similarity', [human, monkey]))
+        assert_same(db, build(all_nodes, all_links[1:] + [nested_link]))
+
+        # Recursively, links pointing to the atom (and to those links) go too
+        db.delete_atom(chimp, recursive=True)
+        nodes = [node for node in all_nodes if node['name'] != 'chimp']
+        nodes.append({'type': 'Predicate', 'name': 'Predicate:has_name'})
+        links = [link for link in all_links[1:] if not mentions(link, 'chimp')]
+        expected = build(nodes, links)
+        assert_same(db, expected)
+        with pytest.raises(NodeDoesNotExist):
+            db.get_node_handle('Concept', 'chimp')
+
+        # Deleted atoms can be added again
+        db.add_link(all_links[0])
+        expected.add_link(all_links[0])
+        assert_same(db, expected)
+
+    @pytest.mark.parametrize(
+        'options',
+        [
+            {},
+            {'columnar_links': True, 'trigram_index': True},
+            {'pattern_index_strategy': PositionalPatternIndex(), 'compact_handles': True},
+            {'pattern_index_strategy': BoundedPatternIndex(1), 'thread_safe': True},
+        ],
+    )
+    def test_bulk_load(self, all_nodes, all_links, nested_link, options):
+        inner = nested_link['targets'][1]
+        # inner is toplevel before the block and stops being toplevel in it
+        atoms = all_nodes + all_links + [nested_link, all_links[0], all_nodes[0]]
+
+        def indexes(db):
+            names = ['patterns', 'templates', 'toplevel_patterns', 'toplevel_templates']
+            names += ['positions', 'nodes_by_type', 'incomming_set']
+            answer = {
+                name: {key: list(ids) for key, ids in getattr(db.db, name).items()}
+                for name in names
+            }
+            answer['atom_type'] = db.db.atom_type
+            answer['partial_pattern_index'] = set(db.partial_pattern_index)
+            return answer
+
+        expected = InMemoryDB(**options)
+        expected.add_link(inner)
+        for atom in atoms:
+            if 'targets' in atom:
+                expected.add_link(atom)
+            else:
+                expected.add_node(atom)
+        db = InMemoryDB(**options)
+        db.add_link(inner)
+        db.add_atoms(atoms)
+        assert indexes(db) == indexes(expected)
+        assert db.count_atoms() == expected.count_atoms()
+        assert sorted(db.get_matched_node_name('Concept', 'mam')) == sorted(
+            expected.get_matched_node_name('Concept', 'mam')
+        )
+        assert gc.isenabled()
+
+        # Atoms are stored at once but indexed when the (outermost) block ends
+        link = {'type': 'Inheritance', 'targets': [all_nodes[0], {'type': 'Fake', 'name': 'x'}]}
+        with db.bulk_load():
+            with db.bulk_load():
+                answer = db.add_link(link)
+            assert db.get_atom(answer['_id'])['named_type'] == 'Inheritance'
+            assert answer['_id'] not in dict(db.get_matched_type('Inheritance'))
+            assert list(db.get_all_nodes('Fake')) == []
+        inheritance = expected.get_matched_type('Inheritance')
+        assert len(db.get_matched_type('Inheritance')) == len(inheritance) + 1
+        assert len(list(db.get_all_nodes('Fake'))) == 1
+
+        # Deleting inside the block indexes the pending atoms first
+        with db.bulk_load():
+            db.add_link(link)
+            db.delete_atom(answer['_id'])
+        assert sorted(db.get_matched_type('Inheritance')) == sorted(inheritance)
+        assert len(list(db.get_all_nodes('Fake'))) == 1
+
+    @pytest.mark.parametrize('options', [{}, {'columnar_links': True, 'trigram_index': True}])
+    def test_memory_stats(self, tmp_path, all_nodes, all_links, options):
+        db = InMemoryDB(**options)
+        db.add_atoms(all_nodes + all_links)
+        nodes, links = db.count_atoms()
+        stats = db.memory_stats()
+        indexes = stats['indexes']
+        assert indexes['node']['entries'] == nodes
+        tables = ['link.arity_1', 'link.arity_2', 'link.arity_n']
+        assert sum(indexes[table]['entries'] for table in tables) == links
+        assert indexes['templates']['postings'] == 2 * links
+        assert indexes['outgoing_set']['postings'] == 2 * links
+        assert indexes['patterns']['entries'] == len(db.db.patterns)
+        assert ('node_names' in indexes) == bool(options.get('trigram_index'))
+        caches = stats['caches']
+        assert stats['bytes'] == sum(
+            stats['bytes'] for stats in [*indexes.values(), *caches.values()]
+        )
+        assert stats['mapped_bytes'] == 0
+        by_type = {
+            link_type: len(db.get_matched_type(link_type)) for link_type in stats['link_types']
+        }
+        assert {name: types['links'] for name, types in stats['link_types'].items()} == by_type
+        assert sum(by_type.values()) == links
+        # Links of the same size take the same (estimated) bytes per link
+        similarity, inheritance = (
+            stats['link_types']['Similarity'],
+            stats['link_types']['Inheritance'],
+        )
+        assert similarity['bytes'] / similarity['links'] == pytest.approx(
+            inheritance['bytes'] / inheritance['links'], rel=0.01
+        )
+
+        db.delete_atom(db.get_matched_type('Inheritance')[0][0])
+        assert db.memory_stats()['link_types']['Inheritance']['links'] == by_type['Inheritance'] - 1
+
+        path = str(tmp_path / 'das.snapshot')
+        db.save_snapshot(path)
+        snapshot = InMemoryDB.open_snapshot(path)
+        mapped = snapshot.memory_stats()
+        assert mapped['mapped_bytes'] > 0
+        assert mapped['bytes'] <= mapped['mapped_bytes']
+        assert mapped['link_types'] == {
+            name: {'links': types['links'], 'bytes': mapped['link_types'][name]['bytes']}
+            for name, types in db.memory_stats()['link_types'].items()
+        }
+        for name in ['node', 'incomming_set', 'patterns', 'templates']:
+            assert (
+                mapped['indexes'][name]['entries'] == db.memory_stats()['indexes'][name]['entries']
+            )
+
+    def test_thread_safe(self, build_db, all_nodes):
+        db = build_db(links=[], thread_safe=True)
+        human = db.get_node_handle('Concept', 'human')
+        names = [f'concept {i}' for i in range(200)]
+        errors = []
+        done = threading.Event()
+
+        def write():
+            for name in names:
+                db.add_link(
+                    {
+                        'type': 'Similarity',
+                        'targets': [
+                            {'type': 'Concept', 'name': 'human'},
+                            {'type': 'Concept', 'name': name},
+                        ],
+                    }
+                )
+            done.set()
+
+        def read():
+            try:
+                seen = 0
+                while not done.is_set():
+                    matches = db.get_matched_links('Similarity', [human, '*'])
+                    assert len(matches) >= seen
+                    assert all(targets[0] == human for _, targets in matches)
+                    nodes = db.get_all_nodes('Concept', names=True)
+                    assert len(list(nodes)) >= len(all_nodes)
+                    assert db.get_node_handle('Concept', 'human') == human
+                    seen = len(matches)
+            except Exception as exception:  # pragma no cover
+                errors.append(exception)
+
+        readers = [threading.Thread(target=read) for _ in range(4)]
+        writer = threading.Thread(target=write)
+        for thread in readers + [writer]:
+            thread.start()
+        for thread in readers + [writer]:
+            thread.join()
+        assert errors == []
+        assert len(db.get_matched_links('Similarity', [human, '*'])) == len(names)
+        assert isinstance(db.get_all_nodes('Concept'), Iterator)
+
+    def test_trigram_index(self, database: InMemoryDB, build_db):
+        db = build_db(links=[], trigram_index=True)
+        db.add_node({'type': 'Predicate', 'name': 'mammal'})
+        database.add_node({'type': 'Predicate', 'name': 'mammal'})
+        for substring in ['', 'a', 'ma', 'mal', 'mam', 'rhino', 'animal', 'xyz', 'ceratops']:
+            for node_type in ['Concept', 'Predicate', 'Fake']:
+                actual = db.get_matched_node_name(node_type, substring)
+                assert list(actual) == list(database.get_matched_node_name(node_type, substring))
+        assert list(db.get_matched_node_name('Predicate', 'mal')) == [
+            db.get_node_handle('Predicate', 'mammal')
+        ]
+        db.clear_database()
+        assert list(db.get_matched_node_name('Concept', 'mal')) == []
+
+    def test_atom_directory(self, database: InMemoryDB):
+        directory = database.db.directory
+        human = database.get_node_handle('Concept', 'human')
+        chimp = database.get_node_handle('Concept', 'chimp')
+        link = database.get_link_handle('Similarity', [human, chimp])
+        assert len(directory) == sum(database.count_atoms())
+        assert directory.kind(database._get_id(human)) == AtomKind.NODE
+        assert directory.kind(database._get_id(link)) == AtomKind.LINK_ARITY_2
+        assert directory.kind(None) is None
+        assert directory.named_type(database._get_id(link)) == 'Similarity'
+        with pytest.raises(NodeDoesNotExist):
+            database.get_node_type(link)
+        with pytest.raises(LinkDoesNotExist):
+            database.get_link_type(human)
+        with pytest.raises(LinkDoesNotExist):
+            database.is_ordered(human)
+        assert AtomKind.of_arity(5).bucket_arity == 3
+        assert database.db.link.get_table(AtomKind.LINK_ARITY_1.bucket_arity) is (
+            database.db.link.arity_1
+        )
+
+    def test_query_cache(self, database: InMemoryDB):
+        human = database.get_node_handle('Concept', 'human')
+        matches = database.get_matched_links('Similarity', [human, '*'])
+        assert database.get_matched_links('Similarity', [human, '*']) == matches
+        matches.clear()
+        assert database.get_matched_links('Similarity', [human, '*']) != []
+        types = database.get_matched_type('Similarity')
+        database.add_link(
+            {
+                'type': 'Similarity',
+                'targets': [
+                    {'type': 'Concept', 'name': 'human'},
+                    {'type': 'Concept', 'name': 'pet'},
+                ],
+            }
+        )
+        pet = database.get_node_handle('Concept', 'pet')
+        link = database.get_link_handle('Similarity', [human, pet])
+        assert (link, (human, pet)) in database.get_matched_type('Similarity')
+        assert len(database.get_matched_links('Similarity', [human, '*'])) == 4
+        database.delete_atom(link)
+        assert sorted(database.get_matched_type('Similarity')) == sorted(types)
+        assert (link, (human, pet)) not in database.get_matched_links('Similarity', [human, '*'])
+        caches = database.memory_stats()['caches']
+        assert caches['matches']['entries'] == len(database._matches) > 0
+        assert caches['results']['entries'] == 2
+        assert caches['results']['bytes'] > caches['results']['entries']
+
+    @pytest.mark.parametrize('sizes', [(0, 0), (2, 1)])
+    def test_query_cache_size(self, build_db, sizes):
+        database = build_db()
+        small = build_db(query_cache_size=sizes[0], result_cache_size=sizes[1])
+        human = database.get_node_handle('Concept', 'human')
+        for _ in range(2):
+            for link_type in ['Similarity', 'Inheritance']:
+                expected = database.get_matched_links(link_type, [human, '*'])
+                assert small.get_matched_links(link_type, [human, '*']) == expected
+                assert small.get_matched_type(link_type) == database.get_matched_type(link_type)
+        assert len(small._matches) <= sizes[0]
+        assert len(small._results) <= sizes[1]
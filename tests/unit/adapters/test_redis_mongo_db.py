@@ -1,6 +1,8 @@
 import os
 import pickle
+import queue
 import re
+import threading
 from typing import Any, Dict, List, Optional
 from unittest import mock
 
@@ -8,17 +10,28 @@ import pytest
 from pymongo import MongoClient
 from pymongo.collection import Collection
 from pymongo.database import Database
+from pymongo.errors import BulkWriteError
 from redis import Redis
+from redis.exceptions import ResponseError
 
-from hyperon_das_atomdb.adapters import RedisMongoDB
-from hyperon_das_atomdb.adapters.redis_mongo_db import MongoCollectionNames, MongoFieldNames
+from hyperon_das_atomdb.adapters import RedisMongoDB, redis_mongo_db
+from hyperon_das_atomdb.adapters.redis_mongo_db import (
+    KeyPrefix,
+    MongoCollectionNames,
+    MongoFieldNames,
+)
+from hyperon_das_atomdb.entity import AtomKind
 from hyperon_das_atomdb.exceptions import (
     AddLinkException,
     AddNodeException,
+    InvalidHashScheme,
+    InvalidOperationException,
     LinkDoesNotExist,
     NodeDoesNotExist,
 )
 from hyperon_das_atomdb.utils.expression_hasher import ExpressionHasher
+from hyperon_das_atomdb.utils.handles import handle_codec
+from hyperon_das_atomdb.utils.members import encode_member
 
 node_collection_mock_data = [
     {
@@ -2925,8 +2938,21 @@ names_redis_mock_data = {
 
 class TestRedisMongoDB:
     @pytest.fixture()
-    def mongo_db(self):
+    def mongo_metadata_collection(self):
+        collection = mock.MagicMock(spec=Collection, name=MongoCollectionNames.METADATA)
+        collection.find_one = mock.Mock(return_value=None)
+        return collection
+
+    @pytest.fixture()
+    def mongo_db(self, mongo_metadata_collection):
         mongo_db = mock.MagicMock(spec=Database, client=mock.Mock(spec=MongoClient), name='db-test')
+
+        def get_collection(name: str):
+            if name == MongoCollectionNames.METADATA:
+                return mongo_metadata_collection
+            return mock.MagicMock(spec=Collection, name=name)
+
+        mongo_db.get_collection = mock.Mock(side_effect=get_collection)
         return mongo_db
 
     @pytest.fixture()
@@ -2964,7 +2990,36 @@ class TestRedisMongoDB:
                 else:
                     return []
 
+        def sscan(key: str, cursor: int = 0, count: Optional[int] = None):
+            return 0, list(smembers(key))
+
+        def lrange(key: str, start: int, end: int):
+            return smembers(key)
+
         redis_db.smembers = mock.Mock(side_effect=smembers)
+        redis_db.sscan = mock.Mock(side_effect=sscan)
+        redis_db.lrange = mock.Mock(side_effect=lrange)
+
+        hashes = {}
+
+        def hset(key, field=None, value=None, mapping=None):
+            hashes.setdefault(key, {}).update(mapping or {field: value})
+
+        def hget(key, field):
+            return hashes.get(key, {}).get(field)
+
+        redis_db.hset = mock.Mock(side_effect=hset)
+        redis_db.hget = mock.Mock(side_effect=hget)
+
+        def pipeline(transaction=True):
+            # Commands go straight to the mock; execute() has nothing left to send
+            pipe = mock.MagicMock()
+            for command in ['hset', 'sadd', 'srem', 'delete', 'rpush', 'hdel']:
+                setattr(pipe, command, getattr(redis_db, command))
+            pipe.execute = mock.Mock(return_value=[])
+            return pipe
+
+        redis_db.pipeline = mock.Mock(side_effect=pipeline)
         return redis_db
 
     @pytest.fixture()
@@ -2981,17 +3036,23 @@ class TestRedisMongoDB:
                 if data['_id'] == handle['_id']:
                     return data
 
-        def find(_filter: Optional[Any] = None):
+        def find(_filter: Optional[Any] = None, projection: Optional[Dict[str, int]] = None):
             if _filter is None:
                 return node_collection_mock_data + added_nodes
             else:
                 ret = []
                 for node in node_collection_mock_data + added_nodes:
-                    if (
-                        _filter[MongoFieldNames.TYPE] == node[MongoFieldNames.TYPE]
-                        and _filter[MongoFieldNames.NODE_NAME]['$regex']
+                    if _filter[MongoFieldNames.TYPE] == node[MongoFieldNames.TYPE] and (
+                        MongoFieldNames.NODE_NAME not in _filter
+                        or _filter[MongoFieldNames.NODE_NAME]['$regex']
                         in node[MongoFieldNames.NODE_NAME]
                     ):
+                        if projection:
+                            node = {
+                                key: value
+                                for key, value in node.items()
+                                if projection.get(key, 1 if key == '_id' else 0)
+                            }
                         ret.append(node)
                 return ret
 
@@ -3053,9 +3114,16 @@ class TestRedisMongoDB:
                 if data['_id'] == _filter['_id']:
                     return data
 
-        def find(_filter: Optional[Any] = None):
+        def find(_filter: Optional[Any] = None, projection: Optional[Dict[str, int]] = None):
             if _filter is None:
                 return arity_2_collection_mock_data
+            if isinstance(_filter.get('_id'), dict):
+                return [
+                    data
+                    for data in arity_2_collection_mock_data
+                    if data['_id'] in _filter['_id']['$in']
+                    and data['is_toplevel'] == _filter.get('is_toplevel', data['is_toplevel'])
+                ]
             return []
 
         def insert_many(documents: List[Dict[str, Any]], ordered: bool):
@@ -3302,18 +3370,26 @@ class TestRedisMongoDB:
                 ),
             )
         ]
+        database.mongo_link_collection['2'].find_one.reset_mock()
         actual = database.get_matched_links('Evaluation', ['*', '*'], {'toplevel_only': True})
 
         assert expected == actual
         assert len(actual) == 1
+        database.mongo_link_collection['2'].find_one.assert_not_called()
+        assert database.mongo_link_collection['2'].find.call_count == 1
 
     def test_get_all_nodes(self, database):
-        ret = database.get_all_nodes('Concept')
+        ret = list(database.get_all_nodes('Concept'))
         assert len(ret) == 14
-        ret = database.get_all_nodes('Concept', True)
+        ret = list(database.get_all_nodes('Concept', True))
         assert len(ret) == 14
-        ret = database.get_all_nodes('ConceptFake')
+        assert 'human' in ret
+        ret = list(database.get_all_nodes('ConceptFake'))
         assert len(ret) == 0
+        database.mongo_nodes_collection.find.assert_called_with(
+            {MongoFieldNames.TYPE: database._get_atom_type_hash('ConceptFake')},
+            projection={MongoFieldNames.ID_HASH: 1},
+        )
 
     def test_get_all_nodes_error(self, database):
         with mock.patch(
@@ -3354,6 +3430,23 @@ class TestRedisMongoDB:
         assert len(inheritance[0]) == 12
         assert len(similarity[0]) == 14
 
+    def test_get_matched_type_paginated(self, database):
+        expected = database.get_matched_type('Inheritance')
+        cursor, matches = database.get_matched_type('Inheritance', {'cursor': 0, 'page_size': 5})
+        assert cursor == 0
+        assert matches == expected
+        key = database.redis.sscan.call_args[0][0]
+        database.redis.sscan.assert_called_with(key, 0, count=5)
+
+        cursor, matches = database.get_matched_links(
+            'Evaluation', ['*', '*'], {'cursor': 0, 'toplevel_only': True}
+        )
+        assert (cursor, matches) == (
+            0,
+            database.get_matched_links('Evaluation', ['*', '*'], {'toplevel_only': True}),
+        )
+        assert database.get_matched_links('Fake', ['*', '*'], {'cursor': 0}) == (0, [])
+
     def test_get_matched_type_toplevel_only(self, database):
         ret = database.get_matched_type('Evaluation')
         assert len(ret[0]) == 2
@@ -3433,7 +3526,7 @@ class TestRedisMongoDB:
     def test_add_node(self, database):
         added_nodes.clear()
         assert (14, 28) == database.count_atoms()
-        all_nodes_before = database.get_all_nodes('Concept')
+        all_nodes_before = list(database.get_all_nodes('Concept'))
         database.add_node(
             {
                 'type': 'Concept',
@@ -3441,7 +3534,7 @@ class TestRedisMongoDB:
             }
         )
         database.commit()
-        all_nodes_after = database.get_all_nodes('Concept')
+        all_nodes_after = list(database.get_all_nodes('Concept'))
         assert len(all_nodes_before) == 14
         assert len(all_nodes_after) == 15
         assert (15, 28) == database.count_atoms()
@@ -3460,7 +3553,7 @@ class TestRedisMongoDB:
         added_links_arity_2.clear()
         assert (14, 28) == database.count_atoms()
 
-        all_nodes_before = database.get_all_nodes('Concept')
+        all_nodes_before = list(database.get_all_nodes('Concept'))
         all_links_before = database.get_matched_type('Similarity')
         database.add_link(
             {
@@ -3472,7 +3565,7 @@ class TestRedisMongoDB:
             }
         )
         database.commit()
-        all_nodes_after = database.get_all_nodes('Concept')
+        all_nodes_after = list(database.get_all_nodes('Concept'))
         all_links_after = database.get_matched_type('Similarity')
 
         assert len(all_nodes_before) == 14
@@ -3523,3 +3616,630 @@ class TestRedisMongoDB:
             exc.value.details
             == "['_id', 'composite_type_hash', 'is_toplevel', 'composite_type', 'named_type', 'named_type_hash', 'key_n']"
         )
+
+    def test_compact_handles(self, database):
+        added_nodes.clear()
+        database.handle_codec = handle_codec(compact_handles=True)
+        database.add_node({'type': 'Concept', 'name': 'lion'})
+        database.commit()
+        lion = ExpressionHasher.terminal_hash('Concept', 'lion')
+        assert added_nodes[-1]['_id'] == bytes.fromhex(lion)
+        assert database.redis.sadd.call_args[0][0] == b'names:' + bytes.fromhex(lion)
+        assert database.get_node_handle('Concept', 'lion') == lion
+        assert lion in database.get_all_nodes('Concept')
+        atom = database.get_atom(lion)
+        assert atom['handle'] == lion
+        assert atom['name'] == 'lion'
+        assert database.get_atom_as_dict(lion)['handle'] == lion
+        added_nodes.clear()
+
+    def test_hash_scheme_metadata(self, database, mongo_metadata_collection):
+        assert database.hasher is ExpressionHasher
+        replace_one = mongo_metadata_collection.replace_one
+        assert replace_one.call_args[0][1] == {
+            '_id': 'hash_scheme',
+            'hash_scheme': 'md5',
+            'hash_scheme_version': 1,
+            # The mocked collections have nodes loaded without the toplevel partitions
+            'toplevel_partitions': False,
+            'directory_bucket_digits': 4,
+        }
+
+        mongo_metadata_collection.find_one.return_value = {
+            '_id': 'hash_scheme',
+            'hash_scheme': 'blake2b-128',
+            'hash_scheme_version': 1,
+        }
+        database._setup_hash_scheme(None)
+        assert database.hasher.hash_scheme == 'blake2b-128'
+        assert not database.toplevel_partitions
+        mongo_metadata_collection.find_one.return_value['toplevel_partitions'] = True
+        database._setup_hash_scheme(None)
+        assert database.toplevel_partitions
+        database._setup_hash_scheme('blake2b-128')
+        assert database.hasher.hash_scheme == 'blake2b-128'
+        assert database.directory_bucket_digits == 4
+        mongo_metadata_collection.find_one.return_value['directory_bucket_digits'] = 6
+        database._setup_hash_scheme(None)
+        assert database.directory_bucket_digits == 6
+        with pytest.raises(InvalidHashScheme) as exc_info:
+            database._setup_hash_scheme('md5')
+        assert exc_info.value.message == 'Mixing hash schemes is not allowed'
+
+    def test_directory_bucket_digits(self, database, mongo_metadata_collection):
+        # Hashes of at most DIRECTORY_BUCKET_ENTRIES atoms on average
+        assert redis_mongo_db._directory_bucket_digits(1000) == 1
+        assert redis_mongo_db._directory_bucket_digits(6 * 10**6) == 4
+        assert redis_mongo_db._directory_bucket_digits(10**8) == 5
+        assert redis_mongo_db._directory_bucket_digits(10**9) == 6
+        mongo_metadata_collection.find_one.return_value = None
+        database.mongo_nodes_collection.find_one.side_effect = None
+        database.mongo_nodes_collection.find_one.return_value = None
+        database.expected_atoms = 10**8
+        database._setup_hash_scheme(None)
+        assert database.directory_bucket_digits == 5
+        assert mongo_metadata_collection.replace_one.call_args[0][1]['directory_bucket_digits'] == 5
+
+    def test_hash_scheme_legacy_data(self, database, mongo_metadata_collection):
+        # Nodes without metadata were hashed with MD5
+        database.mongo_nodes_collection.find_one.side_effect = None
+        database.mongo_nodes_collection.find_one.return_value = node_collection_mock_data[0]
+        database._setup_hash_scheme(None)
+        assert database.hasher is ExpressionHasher
+        with pytest.raises(InvalidHashScheme):
+            database._setup_hash_scheme('blake2b-128')
+
+    def test_redis_name_search(self, database):
+        human = database.get_node_handle('Concept', 'human')
+        mammal = database.get_node_handle('Concept', 'mammal')
+        concept_hash = database._get_atom_type_hash('Concept')
+        pages = {
+            'FT.AGGREGATE': [[2, [b'__key', f'name_search:{human}'.encode()]], 7],
+            'FT.CURSOR': [[1, [b'__key', f'name_search:{mammal}'.encode()]], 0],
+        }
+        database.redis.execute_command.side_effect = lambda command, *args: pages.get(command)
+        database.redis_name_search = True
+        database._setup_name_search()
+        assert database.redis_name_search is True
+
+        assert list(database.get_matched_node_name('Concept', 'ma')) == [human, mammal]
+        query = database.redis.execute_command.call_args_list[-2][0][2]
+        assert query == f'@type:{{{concept_hash}}} @name:{{*ma*}}'
+        database.get_matched_node_name('Concept', 'a b', {'match': 'prefix'})
+        query = database.redis.execute_command.call_args[0][2]
+        assert query == f'@type:{{{concept_hash}}} @name:{{a\\ b*}}'
+        database.get_matched_node_name('Concept', 'mammal', {'match': 'token'})
+        query = database.redis.execute_command.call_args[0][2]
+        assert query == f'@type:{{{concept_hash}}} @name_tokens:(mammal)'
+        with pytest.raises(InvalidOperationException):
+            database.get_matched_node_name('Concept', 'ma', {'match': 'regex'})
+
+        # Terms too short for the index and search errors fall back to Mongo
+        calls = database.redis.execute_command.call_count
+        assert len(list(database.get_matched_node_name('Concept', 'a'))) > 0
+        assert database.redis.execute_command.call_count == calls
+        database.redis.execute_command.side_effect = ResponseError('unknown index name')
+        assert sorted(database.get_matched_node_name('Concept', 'ma')) == sorted(
+            [human, mammal, database.get_node_handle('Concept', 'animal')]
+        )
+        database.get_matched_node_name('Concept', 'ma', {'match': 'prefix'})
+        mongo_filter = database.mongo_nodes_collection.find.call_args[0][0]
+        assert mongo_filter[MongoFieldNames.NODE_NAME] == {'$regex': '^ma'}
+        # Terms are matched literally, tokens regardless of case
+        database.get_matched_node_name('Concept', 'a.b*')
+        mongo_filter = database.mongo_nodes_collection.find.call_args[0][0]
+        assert mongo_filter[MongoFieldNames.NODE_NAME] == {'$regex': re.escape('a.b*')}
+        database.get_matched_node_name('Concept', 'Mammal', {'match': 'token'})
+        mongo_filter = database.mongo_nodes_collection.find.call_args[0][0]
+        assert mongo_filter[MongoFieldNames.NODE_NAME] == {
+            '$regex': r'(^|\W)Mammal($|\W)',
+            '$options': 'i',
+        }
+
+        database.redis.execute_command.side_effect = ResponseError('Unknown command FT.CREATE')
+        database._setup_name_search()
+        assert database.redis_name_search is False
+
+    def test_redis_name_search_index(self, database):
+        database.redis_name_search = True
+        database._update_node_index([node_collection_mock_data[0]])
+        handle = node_collection_mock_data[0]['_id']
+        database.redis.hset.assert_any_call(
+            f'name_search:{handle}',
+            mapping={
+                'name': node_collection_mock_data[0]['name'],
+                'type': node_collection_mock_data[0]['composite_type_hash'],
+            },
+        )
+
+    def test_handle_directory(self, database):
+        added_nodes.clear()
+        added_links_arity_2.clear()
+        link = database.add_link(
+            {
+                'type': 'Similarity',
+                'targets': [
+                    {'type': 'Concept', 'name': 'lion'},
+                    {'type': 'Concept', 'name': 'cat'},
+                ],
+            }
+        )
+        database.commit()
+        lion = database.get_node_handle('Concept', 'lion')
+        assert database._get_directory_entry(lion) == (
+            AtomKind.NODE,
+            database._get_atom_type_hash('Concept'),
+        )
+        assert database._get_directory_entry(link['_id'])[0] == AtomKind.LINK_ARITY_2
+        assert database.redis.hget.call_args[0][0] == f"atoms:{link['_id'][:4]}"
+        database.directory_bucket_digits = 5
+        assert database._directory_key(link['_id']) == f"atoms:{link['_id'][:5]}"
+        digest = bytes.fromhex(link['_id'])
+        assert database._directory_key(digest) == b'atoms:' + bytes.fromhex(link['_id'][:5] + '0')
+        database.directory_bucket_digits = 4
+        assert database._directory_key(digest) == b'atoms:' + digest[:2]
+
+        # Types come from the directory alone
+        database.mongo_nodes_collection.find_one.reset_mock()
+        for collection in database.mongo_link_collection.values():
+            collection.find_one.reset_mock()
+        assert database.get_node_type(lion) == 'Concept'
+        assert database.get_link_type(link['_id']) == 'Similarity'
+        assert database.is_ordered(link['_id'])
+        assert database.mongo_nodes_collection.find_one.call_count == 0
+        assert database.mongo_link_collection['2'].find_one.call_count == 0
+
+        # Atoms are read from their collection with a single query
+        database.mongo_link_collection['2'].find_one.side_effect = None
+        database.mongo_link_collection['2'].find_one.return_value = link
+        assert database.get_atom(link['_id'])['handle'] == link['_id']
+        assert database.get_atom_as_dict(link['_id'])['type'] == 'Similarity'
+        assert database.mongo_link_collection['2'].find_one.call_count == 2
+        assert database.mongo_link_collection['1'].find_one.call_count == 0
+        assert database.mongo_nodes_collection.find_one.call_count == 0
+        assert database.get_atom(lion)['name'] == 'lion'
+        assert database.mongo_nodes_collection.find_one.call_count == 1
+        added_nodes.clear()
+        added_links_arity_2.clear()
+
+    def test_link_index(self, database):
+        added_nodes.clear()
+        added_links_arity_2.clear()
+        links = [
+            database.add_link(self._similarity('lion', 'cat')),
+            database.add_link(self._similarity('lion', 'tiger'), toplevel=False),
+        ]
+        database.commit()
+        added = {}
+        for call in database.redis.sadd.call_args_list:
+            if call[0][0].startswith('names:'):
+                continue
+            assert call[0][0] not in added
+            added[call[0][0]] = call[0][1:]
+        members = [encode_member(link['_id'], (link['key_0'], link['key_1'])) for link in links]
+        lion = links[0]['key_0']
+        # Keys shared by both links get a single SADD with both members
+        assert set(added[f'incomming_set:{lion}']) == {link['_id'] for link in links}
+        assert set(added[f"templates:{links[0]['named_type_hash']}"]) == set(members)
+        pattern = database.hasher.composite_hash([links[0]['named_type_hash'], lion, '*'])
+        assert set(added[f'patterns:{pattern}']) == set(members)
+        for link, member in zip(links, members):
+            outgoing_set = f"outgoing_set:{link['_id']}"
+            database.redis.delete.assert_any_call(outgoing_set)
+            database.redis.rpush.assert_any_call(outgoing_set, link['key_0'], link['key_1'])
+            assert added[f"incomming_set:{link['key_1']}"] == (link['_id'],)
+            pattern = database.hasher.composite_hash([link['named_type_hash'], '*', link['key_1']])
+            assert added[f'patterns:{pattern}'] == (member,)
+        patterns = [key for key in added if key.startswith('patterns:')]
+        # Both links have the patterns with lion or wildcards only
+        assert len(patterns) == 2 * 7 - 4
+        # Only the toplevel link is in the toplevel partitions
+        named_type_hash = links[0]['named_type_hash']
+        assert added[f'toplevel_templates:{named_type_hash}'] == (members[0],)
+        pattern = database.hasher.composite_hash([named_type_hash, lion, '*'])
+        assert added[f'toplevel_patterns:{pattern}'] == (members[0],)
+        assert len([key for key in added if key.startswith('toplevel_patterns:')]) == 7
+        assert database._get_directory_entry(links[1]['_id'])[0] == AtomKind.LINK_ARITY_2
+        database.redis.pipeline.assert_called_with(transaction=False)
+
+        # toplevel_only queries read the partition, without filtering the matches
+        database.toplevel_partitions = True
+        database.redis.smembers.side_effect = lambda key: set(added.get(key, ()))
+        database.mongo_link_collection['2'].find.reset_mock()
+        expected = [(links[0]['_id'], (lion, links[0]['key_1']))]
+        actual = database.get_matched_links('Similarity', [lion, '*'], {'toplevel_only': True})
+        assert actual == expected
+        assert len(database.get_matched_links('Similarity', [lion, '*'])) == 2
+        database.mongo_link_collection['2'].find.assert_not_called()
+        added_nodes.clear()
+        added_links_arity_2.clear()
+
+    def test_node_index(self, database):
+        added_nodes.clear()
+        database.redis_name_search = True
+        pipelines = []
+        new_pipeline = database.redis.pipeline.side_effect
+
+        def pipeline(transaction):
+            pipelines.append(new_pipeline(transaction))
+            return pipelines[-1]
+
+        database.redis.pipeline.side_effect = pipeline
+        for name in ['lion', 'cat', 'dog']:
+            database.add_node({'type': 'Concept', 'name': name})
+        database.commit()
+        # A single round trip for the names, name search hashes and directory entries
+        assert sum(pipe.execute.call_count for pipe in pipelines) == 1
+        database.redis.pipeline.assert_called_with(transaction=False)
+        names = {call[0][1] for call in database.redis.sadd.call_args_list}
+        assert names == {'lion', 'cat', 'dog'}
+        lion = database.get_node_handle('Concept', 'lion')
+        database.redis.hset.assert_any_call(
+            f'name_search:{lion}',
+            mapping={'name': 'lion', 'type': database._get_atom_type_hash('Concept')},
+        )
+        assert database._get_directory_entry(lion)[0] == AtomKind.NODE
+        added_nodes.clear()
+
+    def test_toplevel_after_nested(self, database):
+        added_nodes.clear()
+        insert_many = database.mongo_link_collection['2'].insert_many
+        link = database.add_link(self._similarity('lion', 'cat'), toplevel=False)
+        database.commit()
+        # Added again as toplevel: Mongo keeps the first document, whose flag is updated
+        duplicate = {'writeErrors': [{'code': 11000, 'index': 0}]}
+        insert_many.side_effect = BulkWriteError(duplicate)
+        database.add_link(self._similarity('lion', 'cat'))
+        database.commit()
+        database.mongo_link_collection['2'].update_many.assert_called_once_with(
+            {'_id': {'$in': [link['_id']]}, 'is_toplevel': False},
+            {'$set': {'is_toplevel': True}},
+        )
+        insert_many.side_effect = None
+
+        # Deleting removes it from the toplevel partitions whatever the stored flag
+        database.redis.srem.reset_mock()
+        document = dict(database.handle_codec.encode_document(link), is_toplevel=False)
+        database._delete_link(link['_id'], document, database.redis)
+        removed = {call[0][0] for call in database.redis.srem.call_args_list}
+        assert f"toplevel_templates:{link['named_type_hash']}" in removed
+        assert len([key for key in removed if key.startswith('toplevel_patterns:')]) == 7
+        added_nodes.clear()
+
+    def test_link_targets_order(self, database):
+        added_nodes.clear()
+        link = database.add_link(self._similarity('lion', 'lion'))
+        database.commit()
+        lion = link['key_0']
+        outgoing_set = f"outgoing_set:{link['_id']}"
+        database.redis.rpush.assert_called_once_with(outgoing_set, lion, lion)
+        database.redis.lrange.side_effect = lambda key, start, end: [lion.encode()] * 2
+        assert database.get_link_targets(link['_id']) == [lion, lion]
+        # Sets written by earlier loaders are read from the link document
+        database.redis.lrange.side_effect = ResponseError('WRONGTYPE')
+        document = {'_id': link['_id'], 'key_0': link['key_1'], 'key_1': lion}
+        with mock.patch.object(database, '_retrieve_mongo_document', return_value=document):
+            assert database.get_link_targets(link['_id']) == [link['key_1'], lion]
+        added_nodes.clear()
+
+    def _similarity(self, source: str, target: str) -> Dict[str, Any]:
+        return {
+            'type': 'Similarity',
+            'targets': [{'type': 'Concept', 'name': source}, {'type': 'Concept', 'name': target}],
+        }
+
+    def test_commit_clears_buffers(self, database):
+        added_nodes.clear()
+        database.add_link(self._similarity('lion', 'cat'))
+        database.commit()
+        database.commit()
+        assert database.mongo_link_collection['2'].insert_many.call_count == 1
+        assert all(not buffer for _, buffer in database.mongo_bulk_insertion_buffer.values())
+        added_nodes.clear()
+
+    def test_async_flush(self, database):
+        added_nodes.clear()
+        database.async_flush = True
+        database.mongo_bulk_insertion_limit = 2
+        database._flush_queue = queue.Queue(maxsize=1)
+        release = threading.Event()
+        written = []
+
+        def insert_many(documents, ordered):
+            release.wait(5)
+            written.extend(document['_id'] for document in documents)
+
+        database.mongo_link_collection['2'].insert_many.side_effect = insert_many
+
+        def add_links():
+            for i in range(6):
+                database.add_link(self._similarity(f'a{i}', f'b{i}'))
+
+        adder = threading.Thread(target=add_links)
+        adder.start()
+        adder.join(0.5)
+        # The writer waits on the first batch of links and the queue is full
+        assert adder.is_alive()
+        assert written == []
+        release.set()
+        adder.join(5)
+        assert not adder.is_alive()
+        database.commit()
+        assert len(written) == 6
+        assert len(added_nodes) == 12
+        assert all(not buffer for _, buffer in database.mongo_bulk_insertion_buffer.values())
+        added_nodes.clear()
+
+    def test_async_flush_error(self, database):
+        added_nodes.clear()
+        database.async_flush = True
+        insert_many = database.mongo_link_collection['2'].insert_many
+        insert_many.side_effect = ValueError('Mongo is down')
+        database.add_link(self._similarity('lion', 'cat'))
+        with pytest.raises(ValueError):
+            database.commit()
+        # Raised once, and the links are kept for the next commit
+        database.flush()
+        _, links = database.mongo_bulk_insertion_buffer[MongoCollectionNames.LINKS_ARITY_2]
+        assert len(links) == 1
+        assert database._buffer_bytes[MongoCollectionNames.LINKS_ARITY_2] > 0
+        insert_many.side_effect = None
+        insert_many.reset_mock()
+        database.commit()
+        assert len(insert_many.call_args.args[0]) == 1
+        assert all(not buffer for _, buffer in database.mongo_bulk_insertion_buffer.values())
+        added_nodes.clear()
+
+    def test_close(self, database):
+        added_nodes.clear()
+        database.async_flush = True
+        database.commit_workers = 2
+        database.mongo_bulk_insertion_limit = 2
+        for i in range(3):
+            database.add_link(self._similarity(f'a{i}', f'b{i}'))
+        workers = list(database._flush_workers)
+        assert len(workers) == 2
+        database.close()
+        # The queued and the buffered links are written, and the writers stopped
+        written = database.mongo_link_collection['2'].insert_many.call_args_list
+        assert sum(len(call.args[0]) for call in written) == 3
+        assert database._flush_workers == []
+        assert not any(worker.is_alive() for worker in workers)
+        assert database._flush_queue.unfinished_tasks == 0
+        added_nodes.clear()
+
+    def test_close_pools(self, database):
+        added_nodes.clear()
+        database.commit_workers = 2
+        database.add_link(self._similarity('lion', 'cat'))
+        database.commit()
+        pools = database._pools()
+        database.close()
+        assert database._commit_pool is None and database._index_pool is None
+        for pool in pools:
+            with pytest.raises(RuntimeError):  # shut down
+                pool.submit(print)
+        # Created again by the next parallel commit
+        database.add_link(self._similarity('lion', 'dog'))
+        database.commit()
+        assert database._commit_pool is not None
+        database.close()
+        added_nodes.clear()
+
+    def test_parallel_commit(self, database):
+        added_nodes.clear()
+        database.commit_workers = 2
+        links_written = threading.Event()
+
+        def insert_nodes(documents, ordered):
+            # Only returns if the links are written at the same time
+            assert links_written.wait(5)
+
+        database.mongo_nodes_collection.insert_many.side_effect = insert_nodes
+        database.mongo_link_collection[
+            '2'
+        ].insert_many.side_effect = lambda documents, ordered: links_written.set()
+        database.add_link(self._similarity('lion', 'cat'))
+        database.commit()
+        assert database.mongo_nodes_collection.insert_many.call_count == 1
+        assert database.mongo_link_collection['2'].insert_many.call_count == 1
+        assert all(not buffer for _, buffer in database.mongo_bulk_insertion_buffer.values())
+        added_nodes.clear()
+
+    def test_parallel_commit_error(self, database):
+        added_nodes.clear()
+        database.commit_workers = 2
+        database.mongo_link_collection['2'].insert_many.side_effect = ValueError('Mongo is down')
+        database.add_link(self._similarity('lion', 'cat'))
+        with pytest.raises(ValueError):
+            database.commit()
+        # The nodes were written, the links are kept for the next commit
+        _, nodes = database.mongo_bulk_insertion_buffer[MongoCollectionNames.NODES]
+        _, links = database.mongo_bulk_insertion_buffer[MongoCollectionNames.LINKS_ARITY_2]
+        assert not nodes
+        assert len(links) == 1
+        added_nodes.clear()
+
+    def test_commit_chunks(self, database, monkeypatch):
+        added_nodes.clear()
+        monkeypatch.setattr(redis_mongo_db, 'COMMIT_CHUNK_SIZE', 2)
+        database.commit_workers = 2
+        events = []
+        database.mongo_link_collection[
+            '2'
+        ].insert_many.side_effect = lambda documents, ordered: events.append(
+            ('insert', len(documents))
+        )
+        update_link_index = database._update_link_index
+
+        def index(documents):
+            events.append(('index', len(documents)))
+            update_link_index(documents)
+
+        database._update_link_index = index
+        for i in range(5):
+            database.add_link(self._similarity(f'a{i}', f'b{i}'))
+        database.commit()
+        inserts = [i for i, (event, _) in enumerate(events) if event == 'insert']
+        indexes = [i for i, (event, _) in enumerate(events) if event == 'index']
+        assert [events[i][1] for i in inserts] == [events[i][1] for i in indexes] == [2, 2, 1]
+        # Each chunk is indexed after it's inserted
+        assert all(insert < index for insert, index in zip(inserts, indexes))
+        added_nodes.clear()
+
+    def test_bulk_insertion_bytes(self, database):
+        added_nodes.clear()
+        link = database.handle_codec.encode_document(
+            database.add_link(self._similarity('lion', 'cat'))
+        )
+        database.commit()
+        insert_many = database.mongo_link_collection['2'].insert_many
+        insert_many.reset_mock()
+        # Buffers are written when they reach either ceiling
+        database.mongo_bulk_insertion_bytes = 3 * redis_mongo_db._document_size(link)
+        for i in range(7):
+            database.add_link(self._similarity(f'a{i}', f'b{i}'))
+        assert insert_many.call_count == 2
+        assert [len(call.args[0]) for call in insert_many.call_args_list] == [3, 3]
+        database.commit()
+        assert insert_many.call_count == 3
+        assert database._buffer_bytes[MongoCollectionNames.LINKS_ARITY_2] == 0
+        added_nodes.clear()
+
+    def test_discard_large_documents(self, database):
+        added_nodes.clear()
+        database.max_mongo_db_document_size = 200
+        assert database.add_node({'type': 'Concept', 'name': 'x' * 200}) is None
+        assert database.add_node({'type': 'Concept', 'name': 'lion'}) is not None
+        link = self._similarity('lion', 'cat')
+        link['weight'] = 'y' * 200
+        assert database.add_link(link) is None
+        _, nodes = database.mongo_bulk_insertion_buffer[MongoCollectionNames.NODES]
+        _, links = database.mongo_bulk_insertion_buffer[MongoCollectionNames.LINKS_ARITY_2]
+        # The link's targets are added anyway
+        assert {document.base['name'] for document in nodes} == {'lion', 'cat'}
+        assert not links
+        database.commit()
+        added_nodes.clear()
+
+    def test_adapt_batch_bytes(self, database):
+        key = MongoCollectionNames.LINKS_ARITY_2
+        mb = redis_mongo_db.MIN_BULK_INSERTION_BYTES
+        database.mongo_bulk_insertion_bytes = 64 * mb
+        database.commit_latency = 1.0
+        # 8MB/s: the budget halves at most, down to what takes a second
+        database._adapt_batch_bytes(key, 64 * mb, 8.0)
+        assert database._batch_bytes[key] == 32 * mb
+        database._adapt_batch_bytes(key, 32 * mb, 4.0)
+        assert database._batch_bytes[key] == 16 * mb
+        database._adapt_batch_bytes(key, 16 * mb, 2.0)
+        assert database._batch_bytes[key] == 8 * mb
+        # Faster writes grow it back, up to the ceiling
+        database._adapt_batch_bytes(key, 8 * mb, 0.01)
+        assert database._batch_bytes[key] == 16 * mb
+        for _ in range(5):
+            database._adapt_batch_bytes(key, 16 * mb, 0.01)
+        assert database._batch_bytes[key] == 64 * mb
+        # Small writes don't tell the rate
+        database._adapt_batch_bytes(key, mb - 1, 100.0)
+        assert database._batch_bytes[key] == 64 * mb
+
+    def test_binary_members(self, database):
+        link = database.hasher.terminal_hash('Concept', 'link')
+        targets = tuple(database.hasher.terminal_hash('Concept', name) for name in ['a', 'b'])
+        pickled = pickle.dumps((link, targets))
+        database.redis.smembers.side_effect = lambda key: {encode_member(link, targets), pickled}
+        database.redis.sscan.side_effect = lambda key, cursor, count: (0, [pickled])
+        # Both encodings are read
+        assert database._retrieve_key_value(KeyPrefix.PATTERNS, link) == [(link, targets)] * 2
+        assert database._retrieve_key_value_page(KeyPrefix.TEMPLATES, link, 0, 10) == (
+            0,
+            [(link, targets)],
+        )
+        assert database._encode_match(link, targets) == encode_member(link, targets)
+        database.legacy_members = True
+        assert database._encode_match(link, targets) == pickled
+        # Handles which aren't digests stay pickled
+        database.legacy_members = False
+        assert database._encode_match('link', ('a',)) == pickle.dumps(('link', ('a',)))
+
+    def test_migrate_members(self, database):
+        link = database.hasher.terminal_hash('Concept', 'link')
+        targets = tuple(database.hasher.terminal_hash('Concept', name) for name in ['a', 'b'])
+        pickled = pickle.dumps((link, targets))
+        encoded = encode_member(link, targets)
+        other = encode_member(targets[0], targets[1:])
+        sets = {'patterns:1': [pickled, other], 'templates:2': [pickled], 'templates:3': [other]}
+        database.redis.scan_iter.side_effect = lambda match, count: [
+            key for key in sets if key.startswith(match[:-1])
+        ]
+        database.redis.sscan_iter.side_effect = lambda key, count: list(sets[key])
+        database.redis.sadd.reset_mock()
+        database.redis.srem.reset_mock()
+        assert database.migrate_members() == 2
+        added = [call.args for call in database.redis.sadd.call_args_list]
+        removed = [call.args for call in database.redis.srem.call_args_list]
+        assert sorted(added) == [('patterns:1', encoded), ('templates:2', encoded)]
+        assert sorted(removed) == [('patterns:1', pickled), ('templates:2', pickled)]
+
+        # Pairs pickled as lists are rewritten, other shapes are left as they are
+        as_list = pickle.dumps([link, list(targets)])
+        others = [pickle.dumps(link), pickle.dumps((link, targets, 1)), b'not pickled']
+        sets = {'patterns:1': [as_list, *others]}
+        database.redis.sadd.reset_mock()
+        database.redis.srem.reset_mock()
+        assert database.migrate_members() == 1
+        database.redis.sadd.assert_called_once_with('patterns:1', encoded)
+        database.redis.srem.assert_called_once_with('patterns:1', as_list)
+
+    def test_delete_atom(self, database):
+        node = 'bb34ce95f161a6b37ff54b3d4c817857'
+        link = arity_2_collection_mock_data[0]
+        smembers = database.redis.smembers.side_effect
+
+        def incoming_set(key):
+            if key == f'incomming_set:{node}':
+                return {link['_id'].encode()}
+            if 'incomming_set' in key:
+                return set()
+            return smembers(key)
+
+        database.redis.smembers.side_effect = incoming_set
+        with pytest.raises(InvalidOperationException):
+            database.delete_atom(node)
+        database.mongo_nodes_collection.delete_one.assert_not_called()
+
+        database.node_documents.count = 14
+        pipelines = []
+        new_pipeline = database.redis.pipeline.side_effect
+
+        def pipeline(transaction):
+            pipelines.append(new_pipeline(transaction))
+            return pipelines[-1]
+
+        database.redis.pipeline.side_effect = pipeline
+        database.redis.srem.reset_mock()
+        database.delete_atom(node, recursive=True)
+        # The writes of the node and of the links pointing to it share one pipeline
+        assert len(pipelines) == 1
+        assert pipelines[0].execute.call_count == 1
+        database.redis.pipeline.assert_called_with(transaction=False)
+        database.mongo_link_collection['2'].find.assert_called_once_with(
+            {'_id': {'$in': [link['_id']]}}
+        )
+        assert database.node_documents.size() == 13
+        database.mongo_link_collection['2'].delete_one.assert_called_once_with({'_id': link['_id']})
+        database.mongo_nodes_collection.delete_one.assert_called_once_with({'_id': node})
+        removed = {call[0][0]: call[0][1:] for call in database.redis.srem.call_args_list}
+        targets = (link['key_0'], link['key_1'])
+        # Members of both encodings
+        member = {encode_member(link['_id'], targets), pickle.dumps((link['_id'], targets))}
+        assert set(removed[f"templates:{link['composite_type_hash']}"]) == member
+        assert set(removed[f"templates:{link['named_type_hash']}"]) == member
+        assert removed[f"incomming_set:{link['key_1']}"] == (link['_id'],)
+        patterns = [key for key in removed if key.startswith('patterns:')]
+        assert len(patterns) == 7
+        pattern = database.hasher.composite_hash([link['named_type_hash'], '*', link['key_1']])
+        assert set(removed[f'patterns:{pattern}']) == member
+        database.redis.delete.assert_any_call(f'names:{node}')
+        database.redis.hdel.assert_any_call(f'atoms:{node[:4]}', node)
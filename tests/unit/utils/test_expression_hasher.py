@@ -0,0 +1,84 @@
+import pytest
+
+from hyperon_das_atomdb.exceptions import InvalidHashScheme
+from hyperon_das_atomdb.utils.expression_hasher import HASH_SCHEMES, ExpressionHasher
+
+
+class TestExpressionHasher:
+    def test_named_type_hashes(self):
+        names = ['Concept', 'Similarity', 'Inheritance', '']
+        expected = [ExpressionHasher.named_type_hash(name) for name in names]
+        assert ExpressionHasher.named_type_hashes(names) == expected
+        assert ExpressionHasher.named_type_hashes([]) == []
+
+    def test_terminal_hashes(self):
+        terminals = [('Concept', 'human'), ('Concept', 'monkey'), ('Predicate', 'has name')]
+        expected = [ExpressionHasher.terminal_hash(t, n) for t, n in terminals]
+        assert ExpressionHasher.terminal_hashes(terminals) == expected
+        assert ExpressionHasher.terminal_hashes(iter(terminals)) == expected
+
+    def test_expression_hashes(self):
+        type_hash = ExpressionHasher.named_type_hash('Similarity')
+        human = ExpressionHasher.terminal_hash('Concept', 'human')
+        monkey = ExpressionHasher.terminal_hash('Concept', 'monkey')
+        expressions = [(type_hash, [human, monkey]), (type_hash, [monkey]), (type_hash, [])]
+        expected = [ExpressionHasher.expression_hash(h, e) for h, e in expressions]
+        assert ExpressionHasher.expression_hashes(expressions) == expected
+        assert expected[2] == type_hash
+
+    def test_composite_hashes(self):
+        bases = [['a', 'b'], ['a'], 'c']
+        expected = [ExpressionHasher.composite_hash(base) for base in bases]
+        assert ExpressionHasher.composite_hashes(bases) == expected
+
+    def test_for_scheme(self):
+        assert ExpressionHasher.for_scheme() is ExpressionHasher
+        assert ExpressionHasher.for_scheme('md5') is ExpressionHasher
+        hasher = ExpressionHasher.for_scheme('blake2b-128')
+        assert hasher is ExpressionHasher.for_scheme('blake2b-128')
+        assert issubclass(hasher, ExpressionHasher)
+        assert hasher.metadata() == {'hash_scheme': 'blake2b-128', 'hash_scheme_version': 1}
+        assert ExpressionHasher.metadata()['hash_scheme'] == 'md5'
+        with pytest.raises(InvalidHashScheme) as exc_info:
+            ExpressionHasher.for_scheme('sha0')
+        assert exc_info.value.message == 'Unknown hash scheme'
+
+    @pytest.mark.parametrize('hash_scheme', sorted(HASH_SCHEMES))
+    def test_hash_schemes(self, hash_scheme):
+        hasher = ExpressionHasher.for_scheme(hash_scheme)
+        human = hasher.terminal_hash('Concept', 'human')
+        assert len(human) == 32
+        assert int(human, 16) >= 0
+        if hash_scheme != 'md5':
+            assert human != ExpressionHasher.terminal_hash('Concept', 'human')
+        type_hash = hasher.named_type_hash('Similarity')
+        assert hasher.terminal_hashes([('Concept', 'human')]) == [human]
+        assert hasher.named_type_hashes(['Similarity']) == [type_hash]
+        assert hasher.expression_hashes([(type_hash, [human, human])]) == [
+            hasher.expression_hash(type_hash, [human, human])
+        ]
+
+    def test_named_type_registry(self):
+        registry = ExpressionHasher.named_types
+        concept = registry.named_type_hash('Concept')
+        assert concept == ExpressionHasher.named_type_hash('Concept')
+        assert registry.named_type_hash('Concept') is concept
+        assert registry.named_type(concept) == 'Concept'
+        assert registry.named_type('0' * 32) is None
+        assert registry.typedef_mark_hash == ExpressionHasher.named_type_hash(':')
+        assert registry.base_type_hash == ExpressionHasher.named_type_hash('Type')
+        assert registry.typedef_composite_type_hash == ExpressionHasher.composite_hash(
+            [registry.typedef_mark_hash, registry.base_type_hash, registry.base_type_hash]
+        )
+        composite = [registry.named_type_hash('Similarity'), concept, concept]
+        composite_hash = registry.composite_type_hash(composite)
+        assert composite_hash == ExpressionHasher.composite_hash(composite)
+        assert registry.composite_type_hash(list(composite)) is composite_hash
+
+    def test_named_type_registry_per_scheme(self):
+        hasher = ExpressionHasher.for_scheme('blake2b-128')
+        assert hasher.named_types is not ExpressionHasher.named_types
+        assert hasher.named_types.named_type_hash('Concept') == hasher.named_type_hash('Concept')
+        assert hasher.named_types.named_type_hash('Concept') != (
+            ExpressionHasher.named_types.named_type_hash('Concept')
+        )
@@ -0,0 +1,43 @@
+from hyperon_das_atomdb.utils.expression_hasher import ExpressionHasher
+from hyperon_das_atomdb.utils.handles import CompactHandleCodec, HandleCodec, handle_codec
+
+
+class TestHandleCodec:
+    def test_handle_codec(self):
+        assert type(handle_codec()) is HandleCodec
+        assert type(handle_codec(compact_handles=True)) is CompactHandleCodec
+
+    def test_identity_codec(self):
+        codec = HandleCodec()
+        handle = ExpressionHasher.terminal_hash('Concept', 'human')
+        document = {'_id': handle, 'key_0': handle}
+        assert codec.encode(handle) is handle
+        assert codec.decode(handle) is handle
+        assert codec.encode_document(document) is document
+
+    def test_compact_codec(self):
+        codec = CompactHandleCodec()
+        handle = ExpressionHasher.terminal_hash('Concept', 'human')
+        encoded = codec.encode(handle)
+        assert encoded == bytes.fromhex(handle)
+        assert len(encoded) == 16
+        assert codec.decode(encoded) == handle
+        assert codec.decode_list(codec.encode_list([handle, handle])) == [handle, handle]
+        assert codec.encode('handle_123') == 'handle_123'
+        assert codec.encode('z' * 32) == 'z' * 32
+
+    def test_compact_codec_document(self):
+        codec = CompactHandleCodec()
+        handle = ExpressionHasher.terminal_hash('Concept', 'human')
+        type_hash = ExpressionHasher.named_type_hash('Concept')
+        document = {
+            '_id': handle,
+            'composite_type_hash': type_hash,
+            'key_0': handle,
+            'key_1': handle,
+        }
+        encoded = codec.encode_document(document)
+        assert encoded['_id'] == bytes.fromhex(handle)
+        assert encoded['key_1'] == bytes.fromhex(handle)
+        assert encoded['composite_type_hash'] == type_hash
+        assert codec.decode_document(encoded) == document
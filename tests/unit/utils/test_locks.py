@@ -0,0 +1,59 @@
+import threading
+import time
+
+import pytest
+
+from hyperon_das_atomdb.exceptions import InvalidOperationException
+from hyperon_das_atomdb.utils.locks import ReadWriteLock
+
+
+class TestReadWriteLock:
+    def test_concurrent_readers(self):
+        lock = ReadWriteLock()
+        barrier = threading.Barrier(3, timeout=5)
+
+        def read():
+            with lock.read():
+                # Every reader gets here while the others hold the lock
+                barrier.wait()
+
+        threads = [threading.Thread(target=read) for _ in range(3)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        assert not barrier.broken
+
+    def test_writer_is_exclusive(self):
+        lock = ReadWriteLock()
+        events = []
+        reading = threading.Event()
+
+        def write():
+            reading.wait()
+            with lock.write():
+                events.append('write')
+
+        writer = threading.Thread(target=write)
+        writer.start()
+        with lock.read():
+            reading.set()
+            time.sleep(0.05)
+            events.append('read')
+        writer.join()
+        assert events == ['read', 'write']
+
+    def test_reentrancy(self):
+        lock = ReadWriteLock()
+        with lock.write():
+            with lock.write():
+                with lock.read():
+                    pass
+        with lock.read():
+            with lock.read():
+                with pytest.raises(InvalidOperationException):
+                    with lock.write():
+                        pass
+        # Everything was released
+        with lock.write():
+            pass
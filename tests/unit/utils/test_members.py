@@ -0,0 +1,34 @@
+import pickle
+
+import pytest
+
+from hyperon_das_atomdb.utils.expression_hasher import ExpressionHasher
+from hyperon_das_atomdb.utils.members import MEMBER_VERSION, decode_member, encode_member
+
+
+class TestMembers:
+    @pytest.mark.parametrize('arity', [1, 2, 5])
+    def test_members(self, arity):
+        handle = ExpressionHasher.terminal_hash('Concept', 'link')
+        targets = tuple(ExpressionHasher.terminal_hash('Concept', str(i)) for i in range(arity))
+        member = encode_member(handle, targets)
+        assert member[0] == MEMBER_VERSION
+        assert len(member) == 1 + 16 * (arity + 1)
+        assert len(member) < len(pickle.dumps((handle, targets)))
+        assert decode_member(member) == (handle, targets)
+        # Compact handles encode the same way
+        compact = [bytes.fromhex(target) for target in targets]
+        assert encode_member(bytes.fromhex(handle), compact) == member
+
+    def test_pickled_members_differ(self):
+        handle = ExpressionHasher.terminal_hash('Concept', 'link')
+        assert pickle.dumps((handle, (handle,)))[0] != MEMBER_VERSION
+
+    def test_invalid_handles(self):
+        handle = ExpressionHasher.terminal_hash('Concept', 'link')
+        with pytest.raises(ValueError):
+            encode_member('handle_123', (handle,))
+        with pytest.raises(ValueError):
+            encode_member(handle + 'ab', (handle,))
+        with pytest.raises(ValueError):
+            encode_member(bytes.fromhex(handle), ['handle_123'])
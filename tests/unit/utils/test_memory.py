@@ -0,0 +1,36 @@
+import sys
+from array import array
+
+from hyperon_das_atomdb.entity import id_array
+from hyperon_das_atomdb.utils.memory import buffer_bytes, document_bytes, index_stats
+
+
+class TestMemory:
+    def test_buffer_bytes(self):
+        ids = id_array(range(100))
+        assert buffer_bytes(ids) == sys.getsizeof(ids)
+        # A view is measured by the data it refers to
+        view = memoryview(bytes(800)).cast('q')
+        assert buffer_bytes(view, bytearray(8)) == 800 + sys.getsizeof(bytearray(8))
+
+    def test_index_stats(self):
+        index = {f'key {key}': id_array(range(key)) for key in range(1, 50)}
+        stats = index_stats(index, sample_size=len(index))
+        exact = sys.getsizeof(index)
+        exact += sum(map(sys.getsizeof, index)) + sum(map(sys.getsizeof, index.values()))
+        assert stats == {'entries': 49, 'postings': sum(range(50)), 'bytes': exact}
+        # Postings are still counted in full
+        assert index_stats(index, sample_size=5)['postings'] == sum(range(50))
+        assert index_stats({}) == {'entries': 0, 'postings': 0, 'bytes': sys.getsizeof({})}
+
+    def test_document_bytes(self):
+        handle = 'a' * 32
+        document = {'_id': handle, 'named_type': 'Concept', 'key_0': handle, 'is_toplevel': True}
+        # Handles and types are owned by other structures
+        assert document_bytes(document) == sys.getsizeof(document)
+        document['name'] = 'human'
+        document['weights'] = array('d', [0.5])
+        expected = (
+            sys.getsizeof(document) + sys.getsizeof('human') + sys.getsizeof(array('d', [0.5]))
+        )
+        assert document_bytes(document) == expected
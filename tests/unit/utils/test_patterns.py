@@ -0,0 +1,45 @@
+import pytest
+
+from hyperon_das_atomdb.database import WILDCARD
+from hyperon_das_atomdb.utils.expression_hasher import ExpressionHasher
+from hyperon_das_atomdb.utils.patterns import (
+    build_patern_keys,
+    generate_binary_matrix,
+    iter_pattern_keys,
+    multiply_binary_matrix_by_string_matrix,
+)
+
+
+def _matrix_pattern_keys(hash_list, hasher=ExpressionHasher):
+    binary_matrix = generate_binary_matrix(len(hash_list))
+    result_matrix = multiply_binary_matrix_by_string_matrix(binary_matrix, hash_list)
+    return [hasher.expression_hash(row[0], row[1:]) for row in result_matrix]
+
+
+class TestPatterns:
+    @pytest.mark.parametrize('size', [1, 2, 3, 4, 6])
+    def test_iter_pattern_keys(self, size):
+        hash_list = [ExpressionHasher.named_type_hash(str(i)) for i in range(size)]
+        keys = list(iter_pattern_keys(hash_list))
+        assert len(keys) == 2**size - 1
+        assert sorted(keys) == sorted(_matrix_pattern_keys(hash_list))
+        assert sorted(build_patern_keys(hash_list)) == sorted(keys)
+
+    def test_iter_pattern_keys_hasher(self):
+        hasher = ExpressionHasher.for_scheme('blake2b-128')
+        hash_list = [hasher.named_type_hash(str(i)) for i in range(3)]
+        expected = _matrix_pattern_keys(hash_list, hasher)
+        assert sorted(iter_pattern_keys(hash_list, hasher)) == sorted(expected)
+
+    def test_iter_pattern_keys_max_wildcards(self):
+        hash_list = ['t', 'a', 'b', 'c']
+        keys = set(iter_pattern_keys(hash_list, max_wildcards=1))
+        expected = {
+            ExpressionHasher.composite_hash(
+                [WILDCARD if i == j else h for i, h in enumerate(hash_list)]
+            )
+            for j in range(4)
+        }
+        assert keys == expected
+        assert list(iter_pattern_keys(hash_list, max_wildcards=0)) == []
+        assert len(list(iter_pattern_keys(hash_list, max_wildcards=2))) == 4 + 6
@@ -0,0 +1,82 @@
+import random
+
+import pytest
+
+from hyperon_das_atomdb.entity import id_array
+from hyperon_das_atomdb.exceptions import InvalidOperationException
+from hyperon_das_atomdb.utils.postings import (
+    add_posting,
+    add_postings,
+    gallop,
+    intersect,
+    page,
+    remove_posting,
+    union,
+)
+
+
+class TestPostings:
+    def test_add_posting(self):
+        postings = id_array()
+        assert add_posting(postings, 3)
+        assert add_posting(postings, 7)
+        assert add_posting(postings, 5)
+        assert add_posting(postings, 1)
+        assert not add_posting(postings, 5)
+        assert not add_posting(postings, 7)
+        assert list(postings) == [1, 3, 5, 7]
+
+    def test_remove_posting(self):
+        postings = id_array([1, 3, 5, 7])
+        assert remove_posting(postings, 5)
+        assert not remove_posting(postings, 5)
+        assert not remove_posting(postings, 8)
+        assert not remove_posting(postings, 0)
+        assert list(postings) == [1, 3, 7]
+
+    def test_add_postings(self):
+        postings = id_array([2, 5])
+        add_postings(postings, [6, 9])
+        assert list(postings) == [2, 5, 6, 9]
+        add_postings(postings, [1, 5, 7])
+        assert list(postings) == [1, 2, 5, 6, 7, 9]
+        add_postings(postings, [])
+        assert list(postings) == [1, 2, 5, 6, 7, 9]
+
+    def test_page(self):
+        postings = id_array([2, 4, 6, 8, 10])
+        assert page(postings, 0, 2) == (5, id_array([2, 4]))
+        assert page(postings, 5, 2) == (9, id_array([6, 8]))
+        assert page(postings, 9, 2) == (0, id_array([10]))
+        assert page(postings, 0, 5) == (0, postings)
+        add_posting(postings, 7)
+        remove_posting(postings, 2)
+        # The cursor is an id, so earlier changes don't shift the next page
+        assert page(postings, 9, 2) == (0, id_array([10]))
+        assert page(postings, 5, 2) == (8, id_array([6, 7]))
+        for size in [0, -1, 2.0, '2', None, True]:
+            with pytest.raises(InvalidOperationException):
+                page(postings, 0, size)
+
+    def test_gallop(self):
+        postings = list(range(0, 100, 2))
+        for start in [0, 3, 10, 49]:
+            for atom_id in range(-1, 102):
+                expected = max(start, (atom_id + 1) // 2)
+                assert gallop(postings, atom_id, start) == min(expected, len(postings))
+
+    @pytest.mark.parametrize('seed', range(5))
+    def test_intersect_and_union(self, seed):
+        rng = random.Random(seed)
+        sets = [set(rng.sample(range(1000), rng.randint(0, 400))) for _ in range(rng.randint(1, 4))]
+        postings = [id_array(sorted(atom_ids)) for atom_ids in sets]
+        assert intersect(*postings) == sorted(set.intersection(*sets))
+        assert union(*postings) == sorted(set.union(*sets))
+
+    def test_edge_cases(self):
+        assert intersect() == []
+        assert union() == []
+        assert intersect([1, 2, 3]) == [1, 2, 3]
+        assert intersect([1, 2, 3], []) == []
+        assert intersect([5], [1, 2, 3]) == []
+        assert union([], [2], [1, 2]) == [1, 2]
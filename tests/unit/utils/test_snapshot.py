@@ -0,0 +1,97 @@
+import pickle
+
+import pytest
+
+from hyperon_das_atomdb.entity import id_array
+from hyperon_das_atomdb.exceptions import InvalidOperationException
+from hyperon_das_atomdb.utils.patterns import (
+    BoundedPatternIndex,
+    FullPatternIndex,
+    PatternIndexStrategy,
+    PositionalPatternIndex,
+)
+from hyperon_das_atomdb.utils.snapshot import (
+    _PREAMBLE,
+    SNAPSHOT_MAGIC,
+    SNAPSHOT_VERSION,
+    Snapshot,
+    SnapshotWriter,
+    decode_key,
+    decode_strategy,
+    encode_key,
+    encode_strategy,
+)
+
+HANDLE = 'af12f10f9ae2002a1607ba0b47ba8407'
+
+
+class TestSnapshot:
+    @pytest.mark.parametrize(
+        'key',
+        [HANDLE, bytes.fromhex(HANDLE), HANDLE.upper(), '*', ('type', 2, 1, 7), 42],
+    )
+    def test_keys(self, key):
+        assert decode_key(encode_key(key)) == key
+
+    def test_sections(self, tmp_path):
+        path = tmp_path / 'index.snapshot'
+        index = {
+            HANDLE: id_array([1, 5, 9]),
+            bytes.fromhex(HANDLE): id_array([2]),
+            ('type', 2): id_array([3, 4]),
+        }
+        postings = {0: id_array([7, 8]), 3: id_array([1])}
+        with open(path, 'wb') as stream:
+            writer = SnapshotWriter(stream)
+            writer.add_index('index', index)
+            writer.add_postings('postings', postings, 5)
+            writer.add_array('names', 'B', b'abc')
+            writer.close({'size': 5})
+
+        snapshot = Snapshot(str(path))
+        assert snapshot.header['size'] == 5
+        assert snapshot.array('names').tobytes() == b'abc'
+        mapped = snapshot.index('index')
+        assert len(mapped) == 3
+        for key, value in index.items():
+            assert list(mapped[key]) == list(value)
+        assert mapped.get('*') is None
+        assert HANDLE.upper() not in mapped
+        assert {key: list(value) for key, value in mapped.items()} == {
+            key: list(value) for key, value in index.items()
+        }
+        mapped = snapshot.postings('postings')
+        assert list(mapped.keys()) == [0, 3]
+        assert list(mapped[0]) == [7, 8]
+        assert mapped.get(1) is None
+        assert mapped.get(5) is None
+
+    @pytest.mark.parametrize(
+        'strategy', [FullPatternIndex(), BoundedPatternIndex(2), PositionalPatternIndex()]
+    )
+    def test_strategies(self, strategy):
+        assert repr(decode_strategy(encode_strategy(strategy))) == repr(strategy)
+
+    def test_unknown_strategies(self):
+        class CustomPatternIndex(PatternIndexStrategy):
+            pass
+
+        with pytest.raises(InvalidOperationException):
+            encode_strategy(CustomPatternIndex())
+        with pytest.raises(InvalidOperationException):
+            decode_strategy(['system', {'command': 'true'}])
+
+    def test_invalid_file(self, tmp_path):
+        path = tmp_path / 'invalid.snapshot'
+        path.write_bytes(bytes(64))
+        with pytest.raises(InvalidOperationException):
+            Snapshot(str(path))
+
+    def test_pickled_header(self, tmp_path):
+        # Headers are JSON: a pickled one is rejected, not unpickled
+        path = tmp_path / 'pickled.snapshot'
+        header = pickle.dumps({'size': 5})
+        preamble = _PREAMBLE.pack(SNAPSHOT_MAGIC, SNAPSHOT_VERSION, 0, _PREAMBLE.size, len(header))
+        path.write_bytes(preamble + header)
+        with pytest.raises(InvalidOperationException):
+            Snapshot(str(path))
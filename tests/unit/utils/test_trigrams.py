@@ -0,0 +1,26 @@
+from hyperon_das_atomdb.utils.trigrams import TrigramIndex, trigrams
+
+
+class TestTrigrams:
+    def test_trigrams(self):
+        assert trigrams('') == set()
+        assert trigrams('ab') == set()
+        assert trigrams('abc') == {'abc'}
+        assert trigrams('aaaa') == {'aaa'}
+        assert trigrams('mammal') == {'mam', 'amm', 'mma', 'mal'}
+
+    def test_candidates(self):
+        index = TrigramIndex()
+        names = ['mammal', 'animal', 'human', 'malamute', 'lama']
+        for node_id, name in enumerate(names):
+            index.add('concept', node_id, name)
+        index.add('predicate', len(names), 'mal')
+        assert index.candidates('concept', 'ma') is None
+        assert index.candidates('concept', 'mal') == [0, 1, 3]
+        assert index.candidates('concept', 'mama') == []
+        assert index.candidates('concept', 'xyz') == []
+        assert index.candidates('unknown', 'mal') == []
+        assert index.candidates('predicate', 'mal') == [5]
+        # Trigrams narrow, the caller verifies
+        index.add('concept', 6, 'abcaxbcab')
+        assert index.candidates('concept', 'abcab') == [6]